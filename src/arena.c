@@ -0,0 +1,119 @@
+/*
+    arena.c
+    Bump allocator for strings which only live as long as one file
+
+    Allocations are carved off the end of a block and are never freed
+    individually; the whole arena is reset once a file is finished
+    with. If a file needs more than one block, the blocks are merged
+    into one big enough for it at the next reset, so a long run settles
+    on a single block sized for its largest file.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "arena.h"
+
+
+#define ARENA_ALIGN     8
+#define ARENA_LINK      sizeof(void*)   // Start of each block links the full ones
+
+
+static uint8_t*
+new_block( size_t size )
+{
+    uint8_t * block = malloc( size );
+    if (!block) handle_error( "Unable to allocate memory for arena." );
+    return block;
+}
+
+
+void
+arena_init( arena_t* arena, size_t size )
+{
+    memset( arena, 0, sizeof(arena_t) );
+    arena->size = size ? size : ARENA_DEFAULT_SIZE;
+    arena->block = new_block( arena->size );
+    arena->used = ARENA_LINK;
+}
+
+
+// Returns len bytes which stay valid until the next reset
+void*
+arena_alloc( arena_t* arena, size_t len )
+{
+    size_t start = (arena->used + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+    void * p;
+
+    if (start + len > arena->size) {
+        size_t size = arena->size * 2;
+        if (size < len + ARENA_LINK) size = len + ARENA_LINK;
+
+        // Chain the full block on, so that what was allocated
+        // from it stays where it is
+        *(void**)arena->block = arena->full;
+        arena->full = arena->block;
+        arena->block = new_block( size );
+        arena->size = size;
+        start = ARENA_LINK;
+    }
+
+    p = arena->block + start;
+    arena->used = start + len;
+    arena->total += len;
+    return p;
+}
+
+
+void
+arena_reset( arena_t* arena )
+{
+    if (arena->full) {
+        size_t size = arena->total + ARENA_DEFAULT_SIZE;
+
+        while (arena->full) {
+            void * next = *(void**)arena->full;
+            free( arena->full );
+            arena->full = next;
+        }
+        if (size > arena->size) {
+            free( arena->block );
+            arena->block = new_block( size );
+            arena->size = size;
+        }
+    }
+
+    arena->used = ARENA_LINK;
+    arena->total = 0;
+}
+
+
+void
+arena_free( arena_t* arena )
+{
+    arena_reset( arena );
+    free( arena->block );
+    arena->block = NULL;
+    arena->size = 0;
+}
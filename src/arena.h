@@ -0,0 +1,43 @@
+/*
+    arena.h
+    Bump allocator for strings which only live as long as one file
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#define ARENA_DEFAULT_SIZE  (16*1024)
+
+
+typedef struct {
+    uint8_t * block;        // Block currently being allocated from
+    size_t size;
+    size_t used;
+    void * full;            // Earlier blocks, still in use until a reset
+    size_t total;           // Bytes allocated since the last reset
+} arena_t;
+
+
+void arena_init( arena_t* arena, size_t size );
+void* arena_alloc( arena_t* arena, size_t len );
+void arena_reset( arena_t* arena );
+void arena_free( arena_t* arena );
+
+#endif //_ARENA_H
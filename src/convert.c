@@ -0,0 +1,608 @@
+/*
+    convert.c
+    Streaming PCM sample format and sample rate conversion
+
+    Samples are converted a block at a time to interleaved floats,
+    optionally resampled with a polyphase windowed-sinc filter, and
+    then quantised to the output format with TPDF dither.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "convert.h"
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define KAISER_BETA     9.0         // Roughly -90dB stopband
+#define CUTOFF          0.94        // Fraction of the lower Nyquist frequency kept
+
+
+// Parse a sample type such as 's16' or 'f32'
+// Returns 0 if the string isn't a known type
+int
+convert_parse_type( const char* str, sample_type_t* type )
+{
+    if (!strcmp( str, "s16" ) || !strcmp( str, "int16" )) {
+        type->width = 2; type->isFloat = 0;
+    } else if (!strcmp( str, "s24" ) || !strcmp( str, "int24" )) {
+        type->width = 3; type->isFloat = 0;
+    } else if (!strcmp( str, "s32" ) || !strcmp( str, "int32" )) {
+        type->width = 4; type->isFloat = 0;
+    } else if (!strcmp( str, "f32" ) || !strcmp( str, "float32" )) {
+        type->width = 4; type->isFloat = 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+
+// Work out the sample type of a fmt chunk, from its block alignment
+// Returns 0 if it isn't linear PCM that can be converted
+int
+convert_input_type( const wave_format_t* fmt, sample_type_t* type )
+{
+    uint16_t format = wave_sample_format( fmt );
+
+    if (fmt->channels == 0 || fmt->blockAlign % fmt->channels) return 0;
+    type->width = fmt->blockAlign / fmt->channels;
+    type->isFloat = (format == WAVE_FORMAT_FLOAT);
+
+    if (format == WAVE_FORMAT_PCM)
+        return (type->width >= 1 && type->width <= 4);
+    if (format == WAVE_FORMAT_FLOAT)
+        return (type->width == 4);
+    return 0;
+}
+
+
+static uint64_t
+gcd( uint64_t a, uint64_t b )
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+// Number of output frames for a number of input frames
+uint64_t
+convert_out_frames( uint64_t inFrames, uint32_t inRate, uint32_t outRate )
+{
+    if (inRate == outRate) return inFrames;
+    return (inFrames * outRate + inRate - 1) / inRate;
+}
+
+
+
+/* ---- Conversion to float ---- */
+
+static void
+u8_to_float( const uint8_t* in, float* out, size_t n )
+{
+    size_t i;
+    for (i=0; i<n; i++)
+        out[i] = ((int)in[i] - 128) * (1.0f / 128.0f);
+}
+
+
+static void
+s16_to_float( const uint8_t* in, float* out, size_t n )
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps( 1.0f / 32768.0f );
+    for (; i+8<=n; i+=8) {
+        __m128i x = _mm_loadu_si128( (const __m128i*)(in + 2*i) );
+        __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( x, x ), 16 );
+        __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( x, x ), 16 );
+        _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( lo ), scale ) );
+        _mm_storeu_ps( out + i + 4, _mm_mul_ps( _mm_cvtepi32_ps( hi ), scale ) );
+    }
+#endif
+
+    for (; i<n; i++) {
+        int16_t s = (int16_t)(in[2*i] | (in[2*i+1] << 8));
+        out[i] = s * (1.0f / 32768.0f);
+    }
+}
+
+
+static void
+s24_to_float( const uint8_t* in, float* out, size_t n )
+{
+    size_t i;
+    for (i=0; i<n; i++) {
+        int32_t s = (int32_t)(((uint32_t)in[3*i] << 8) | ((uint32_t)in[3*i+1] << 16) |
+                              ((uint32_t)in[3*i+2] << 24)) >> 8;
+        out[i] = s * (1.0f / 8388608.0f);
+    }
+}
+
+
+static void
+s32_to_float( const uint8_t* in, float* out, size_t n )
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps( 1.0f / 2147483648.0f );
+    for (; i+4<=n; i+=4) {
+        __m128i x = _mm_loadu_si128( (const __m128i*)(in + 4*i) );
+        _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( x ), scale ) );
+    }
+#endif
+
+    for (; i<n; i++) {
+        const uint8_t* p = in + 4*i;
+        int32_t s = (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+        out[i] = s * (1.0f / 2147483648.0f);
+    }
+}
+
+
+static void
+f32_to_float( const uint8_t* in, float* out, size_t n )
+{
+#ifdef WORDS_BIGENDIAN
+    size_t i;
+    for (i=0; i<n; i++) {
+        const uint8_t* p = in + 4*i;
+        uint32_t bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        memcpy( &out[i], &bits, 4 );
+    }
+#else
+    memcpy( out, in, n * 4 );
+#endif
+}
+
+
+static void
+to_float( const sample_type_t* type, const uint8_t* in, float* out, size_t n )
+{
+    if (type->isFloat) f32_to_float( in, out, n );
+    else if (type->width == 1) u8_to_float( in, out, n );
+    else if (type->width == 2) s16_to_float( in, out, n );
+    else if (type->width == 3) s24_to_float( in, out, n );
+    else s32_to_float( in, out, n );
+}
+
+
+
+/* ---- Conversion from float, with optional dither ---- */
+
+static int32_t
+quantise( float x, float scale, float dither, float max )
+{
+    float v = x * scale + dither;
+    if (v >= max) return (int32_t)max;
+    if (v <= -scale) return (int32_t)-scale;
+    if (v != v) return 0;
+    return (int32_t)lrintf( v );
+}
+
+
+#ifdef __SSE2__
+// Clamp four samples the same way as quantise(): NaN becomes 0.
+// NaNs are zeroed first, since minps/maxps pass them through unevenly
+static __m128
+clamp_ps( __m128 x, __m128 lo, __m128 hi )
+{
+    x = _mm_and_ps( x, _mm_cmpord_ps( x, x ) );
+    return _mm_max_ps( _mm_min_ps( x, hi ), lo );
+}
+#endif
+
+
+static void
+float_to_s16( const float* in, const float* dither, uint8_t* out, size_t n )
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps( 32768.0f );
+    const __m128 hi = _mm_set1_ps( 32767.0f );
+    const __m128 lo = _mm_set1_ps( -32768.0f );
+    for (; i+8<=n; i+=8) {
+        __m128 a = _mm_mul_ps( _mm_loadu_ps( in + i ), scale );
+        __m128 b = _mm_mul_ps( _mm_loadu_ps( in + i + 4 ), scale );
+        if (dither) {
+            a = _mm_add_ps( a, _mm_loadu_ps( dither + i ) );
+            b = _mm_add_ps( b, _mm_loadu_ps( dither + i + 4 ) );
+        }
+        // Clamp before converting, as out of range values would
+        // convert to -32768, then round to nearest and pack
+        a = clamp_ps( a, lo, hi );
+        b = clamp_ps( b, lo, hi );
+        _mm_storeu_si128( (__m128i*)(out + 2*i),
+                          _mm_packs_epi32( _mm_cvtps_epi32( a ), _mm_cvtps_epi32( b ) ) );
+    }
+#endif
+
+    for (; i<n; i++) {
+        int32_t s = quantise( in[i], 32768.0f, dither ? dither[i] : 0.0f, 32767.0f );
+        out[2*i] = s & 0xFF;
+        out[2*i+1] = (s >> 8) & 0xFF;
+    }
+}
+
+
+static void
+float_to_s24( const float* in, const float* dither, uint8_t* out, size_t n )
+{
+    size_t i;
+    for (i=0; i<n; i++) {
+        int32_t s = quantise( in[i], 8388608.0f, dither ? dither[i] : 0.0f, 8388607.0f );
+        out[3*i] = s & 0xFF;
+        out[3*i+1] = (s >> 8) & 0xFF;
+        out[3*i+2] = (s >> 16) & 0xFF;
+    }
+}
+
+
+static void
+float_to_s32( const float* in, const float* dither, uint8_t* out, size_t n )
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Largest float below 2^31, so that the conversion can't overflow
+    const __m128 scale = _mm_set1_ps( 2147483648.0f );
+    const __m128 hi = _mm_set1_ps( 2147483520.0f );
+    const __m128 lo = _mm_set1_ps( -2147483648.0f );
+    for (; i+4<=n; i+=4) {
+        __m128 a = _mm_mul_ps( _mm_loadu_ps( in + i ), scale );
+        if (dither) a = _mm_add_ps( a, _mm_loadu_ps( dither + i ) );
+        _mm_storeu_si128( (__m128i*)(out + 4*i), _mm_cvtps_epi32( clamp_ps( a, lo, hi ) ) );
+    }
+#endif
+
+    for (; i<n; i++) {
+        int32_t s = quantise( in[i], 2147483648.0f, dither ? dither[i] : 0.0f, 2147483520.0f );
+        out[4*i] = s & 0xFF;
+        out[4*i+1] = (s >> 8) & 0xFF;
+        out[4*i+2] = (s >> 16) & 0xFF;
+        out[4*i+3] = (s >> 24) & 0xFF;
+    }
+}
+
+
+static void
+float_to_f32( const float* in, uint8_t* out, size_t n )
+{
+#ifdef WORDS_BIGENDIAN
+    size_t i;
+    for (i=0; i<n; i++) {
+        uint32_t bits;
+        memcpy( &bits, &in[i], 4 );
+        out[4*i] = bits & 0xFF;
+        out[4*i+1] = (bits >> 8) & 0xFF;
+        out[4*i+2] = (bits >> 16) & 0xFF;
+        out[4*i+3] = (bits >> 24) & 0xFF;
+    }
+#else
+    memcpy( out, in, n * 4 );
+#endif
+}
+
+
+// Triangular PDF noise, of +/- 1 LSB, from the sum of two uniform values
+static void
+make_dither( convert_t* conv, float* noise, size_t n )
+{
+    uint32_t x = conv->seed;
+    size_t i;
+
+    for (i=0; i<n; i++) {
+        float a, b;
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        a = (x >> 8) * (1.0f / 16777216.0f);
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        b = (x >> 8) * (1.0f / 16777216.0f);
+        noise[i] = a - b;
+    }
+
+    conv->seed = x;
+}
+
+
+// Quantise and write frames of interleaved floats
+static void
+emit_frames( convert_t* conv, const float* in, size_t frames )
+{
+    size_t n;
+    const float* dither = NULL;
+
+    if (frames > conv->outFramesLeft) frames = conv->outFramesLeft;
+    if (frames == 0) return;
+    n = frames * conv->channels;
+
+    if (conv->dither) {
+        make_dither( conv, conv->noise, n );
+        dither = conv->noise;
+    }
+
+    if (conv->out.isFloat) float_to_f32( in, conv->outbuf, n );
+    else if (conv->out.width == 2) float_to_s16( in, dither, conv->outbuf, n );
+    else if (conv->out.width == 3) float_to_s24( in, dither, conv->outbuf, n );
+    else float_to_s32( in, dither, conv->outbuf, n );
+
+    write_bytes( conv->out_fd, conv->outbuf, n * conv->out.width );
+    conv->outFramesLeft -= frames;
+}
+
+
+
+/* ---- Resampling ---- */
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double
+bessel_i0( double x )
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k=1; k<50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+
+static void
+build_filter( convert_t* conv )
+{
+    int N = conv->L * conv->K;
+    int larger = conv->L > conv->M ? conv->L : conv->M;
+    double fc = 0.5 * CUTOFF / larger;     // Cycles per sample at the interpolated rate
+    int centre = (N - 1) / 2;          // Whole samples, to match resample_block()
+    double norm = bessel_i0( KAISER_BETA );
+    int n;
+
+    conv->filter = malloc( (size_t)N * sizeof(float) );
+    if (!conv->filter)
+        handle_error( "Unable to allocate memory for resampling filter." );
+
+    for (n=0; n<N; n++) {
+        double t = n - centre;
+        double r = t / (centre + 1);
+        double sinc = (t == 0.0) ? 1.0 : sin( 2.0 * M_PI * fc * t ) / (M_PI * t * 2.0 * fc);
+        double window = bessel_i0( KAISER_BETA * sqrt( 1.0 - r*r ) ) / norm;
+        double h = 2.0 * fc * sinc * window * conv->L;
+
+        // Store as phases of K taps, so that each output is a contiguous dot product
+        conv->filter[ (n % conv->L) * conv->K + n / conv->L ] = (float)h;
+    }
+}
+
+
+// Calculate every output frame that the history allows
+static void
+resample_block( convert_t* conv )
+{
+    int ch = conv->channels;
+    int64_t histEnd = conv->histStart + (int64_t)conv->histLen;
+    uint64_t centre = ((uint64_t)conv->L * conv->K - 1) / 2;
+    size_t produced = 0;
+    int64_t keep;
+
+    while (conv->outFramesLeft > produced) {
+        uint64_t t = conv->outPos * conv->M + centre;
+        int64_t base = t / conv->L;
+        const float* f = conv->filter + (t % conv->L) * conv->K;
+        const float* x;
+        int c, k;
+
+        if (base >= histEnd) break;
+        x = conv->hist + (base - conv->histStart) * ch;
+
+        for (c=0; c<ch; c++) {
+            float acc = 0.0f;
+            for (k=0; k<conv->K; k++)
+                acc += f[k] * x[c - k*ch];
+            conv->resampled[ produced*ch + c ] = acc;
+        }
+
+        conv->outPos++;
+        if (++produced == CONVERT_BLOCK_FRAMES) {
+            emit_frames( conv, conv->resampled, produced );
+            produced = 0;
+        }
+    }
+    emit_frames( conv, conv->resampled, produced );
+
+    // Drop the history that no future output frame will use
+    keep = (int64_t)((conv->outPos * conv->M + centre) / conv->L) - conv->K + 1;
+    if (keep > histEnd) keep = histEnd;
+    if (keep > conv->histStart) {
+        size_t drop = keep - conv->histStart;
+        memmove( conv->hist, conv->hist + drop * ch, (conv->histLen - drop) * ch * sizeof(float) );
+        conv->histLen -= drop;
+        conv->histStart = keep;
+    }
+}
+
+
+// Convert a block of whole input frames
+static void
+convert_frames( convert_t* conv, const uint8_t* data, size_t frames )
+{
+    size_t n = frames * conv->channels;
+
+    if (conv->outFramesLeft == 0) return;
+
+    if (conv->passthrough) {
+        if (frames > conv->outFramesLeft) frames = conv->outFramesLeft;
+        write_bytes( conv->out_fd, data, frames * conv->channels * conv->in.width );
+        conv->outFramesLeft -= frames;
+        return;
+    }
+
+    if (!conv->L) {
+        to_float( &conv->in, data, conv->work, n );
+        emit_frames( conv, conv->work, frames );
+        return;
+    }
+
+    to_float( &conv->in, data, conv->hist + conv->histLen * conv->channels, n );
+    conv->histLen += frames;
+    resample_block( conv );
+}
+
+
+void
+convert_open( convert_t* conv, const wave_format_t* fmt, const sample_type_t* out,
+              uint32_t outRate, uint64_t outFrames, int out_fd )
+{
+    size_t n;
+
+    memset( conv, 0, sizeof(convert_t) );
+    convert_input_type( fmt, &conv->in );
+    conv->out = *out;
+    conv->channels = fmt->channels;
+    conv->out_fd = out_fd;
+    conv->outFramesLeft = outFrames;
+    conv->seed = 0x9E3779B9;
+
+    if (outRate != fmt->sampleRate) {
+        uint64_t g = gcd( fmt->sampleRate, outRate );
+        conv->L = outRate / g;
+        conv->M = fmt->sampleRate / g;
+        if (conv->L > CONVERT_MAX_PHASES)
+            handle_error( "Ratio of sample rates is too complex to resample." );
+
+        // Downsampling needs a longer filter, for the same transition band
+        conv->K = CONVERT_TAPS;
+        if (conv->M > conv->L)
+            conv->K = (CONVERT_TAPS * conv->M + conv->L - 1) / conv->L;
+        if (conv->K > CONVERT_MAX_TAPS) conv->K = CONVERT_MAX_TAPS;
+        conv->K = (conv->K + 1) & ~1;
+
+        build_filter( conv );
+
+        // Start with K-1 frames of silence before the first input frame
+        conv->histCap = conv->K + CONVERT_BLOCK_FRAMES + conv->M / conv->L + 2;
+        conv->hist = calloc( conv->histCap * conv->channels, sizeof(float) );
+        conv->resampled = malloc( CONVERT_BLOCK_FRAMES * conv->channels * sizeof(float) );
+        if (!conv->hist || !conv->resampled)
+            handle_error( "Unable to allocate memory for resampler." );
+        conv->histLen = conv->K - 1;
+        conv->histStart = -(int64_t)conv->histLen;
+    } else if (conv->in.width == out->width && conv->in.isFloat == out->isFloat) {
+        conv->passthrough = 1;
+    }
+
+    // Dither whenever precision is lost
+    conv->dither = !out->isFloat &&
+                   (conv->in.isFloat || conv->L || out->width < conv->in.width);
+
+    n = CONVERT_BLOCK_FRAMES * conv->channels;
+    conv->work = malloc( n * sizeof(float) );
+    conv->noise = malloc( n * sizeof(float) );
+    conv->outbuf = malloc( n * 4 );
+    conv->partial = malloc( fmt->blockAlign );
+    if (!conv->work || !conv->noise || !conv->outbuf || !conv->partial)
+        handle_error( "Unable to allocate memory for sample conversion." );
+}
+
+
+// Copy engine sink: convert the next block of the data chunk
+void
+convert_feed( void* arg, const uint8_t* data, size_t len )
+{
+    convert_t* conv = arg;
+    size_t frameSize = conv->channels * conv->in.width;
+
+    // Complete a frame left over from the previous buffer
+    if (conv->partialLen) {
+        size_t take = frameSize - conv->partialLen;
+        if (take > len) take = len;
+        memcpy( conv->partial + conv->partialLen, data, take );
+        conv->partialLen += take;
+        data += take;
+        len -= take;
+
+        if (conv->partialLen < frameSize) return;
+        convert_frames( conv, conv->partial, 1 );
+        conv->partialLen = 0;
+    }
+
+    while (len >= frameSize) {
+        size_t frames = len / frameSize;
+        if (frames > CONVERT_BLOCK_FRAMES) frames = CONVERT_BLOCK_FRAMES;
+        convert_frames( conv, data, frames );
+        data += frames * frameSize;
+        len -= frames * frameSize;
+    }
+
+    memcpy( conv->partial, data, len );
+    conv->partialLen = len;
+}
+
+
+void
+convert_close( convert_t* conv )
+{
+    // Flush the resampler with silence, and pad a short input to the
+    // length given in the header
+    memset( conv->work, 0, CONVERT_BLOCK_FRAMES * conv->channels * sizeof(float) );
+    while (conv->outFramesLeft) {
+        if (conv->L) {
+            memset( conv->hist + conv->histLen * conv->channels, 0,
+                    CONVERT_BLOCK_FRAMES * conv->channels * sizeof(float) );
+            conv->histLen += CONVERT_BLOCK_FRAMES;
+            resample_block( conv );
+        } else {
+            size_t frames = CONVERT_BLOCK_FRAMES;
+            if (frames > conv->outFramesLeft) frames = conv->outFramesLeft;
+            emit_frames( conv, conv->work, frames );
+        }
+    }
+
+    free( conv->filter );
+    free( conv->hist );
+    free( conv->resampled );
+    free( conv->work );
+    free( conv->noise );
+    free( conv->outbuf );
+    free( conv->partial );
+}
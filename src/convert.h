@@ -0,0 +1,75 @@
+/*
+    convert.h
+    Streaming PCM sample format and sample rate conversion
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _CONVERT_H
+#define _CONVERT_H
+
+#define CONVERT_BLOCK_FRAMES    4096
+#define CONVERT_MAX_PHASES      4096    // Largest interpolation factor for resampling
+#define CONVERT_TAPS            32      // Filter taps per phase when upsampling
+#define CONVERT_MAX_TAPS        256
+
+
+typedef struct {
+    int width;              // Bytes per sample
+    int isFloat;
+} sample_type_t;
+
+
+typedef struct {
+    int channels;
+    sample_type_t in;
+    sample_type_t out;
+    int passthrough;        // Formats match and no resampling
+    int dither;             // Add TPDF dither when quantising
+    uint32_t seed;
+    int out_fd;
+
+    // Resampler: output rate / input rate = L / M
+    int L, M, K;
+    float * filter;         // L phases of K taps
+    float * hist;           // Interleaved input history
+    int64_t histStart;      // Input frame number of hist[0]
+    size_t histLen;
+    size_t histCap;
+    uint64_t outPos;        // Next output frame to be calculated
+
+    uint64_t outFramesLeft;
+    float * work;           // Block of interleaved float samples
+    float * resampled;
+    float * noise;
+    uint8_t * outbuf;
+    uint8_t * partial;      // Frame split across two input blocks
+    size_t partialLen;
+} convert_t;
+
+
+int convert_parse_type( const char* str, sample_type_t* type );
+int convert_input_type( const wave_format_t* fmt, sample_type_t* type );
+uint64_t convert_out_frames( uint64_t inFrames, uint32_t inRate, uint32_t outRate );
+
+void convert_open( convert_t* conv, const wave_format_t* fmt, const sample_type_t* out,
+                   uint32_t outRate, uint64_t outFrames, int out_fd );
+void convert_feed( void* conv, const uint8_t* data, size_t len );
+void convert_close( convert_t* conv );
+
+#endif //_CONVERT_H
@@ -0,0 +1,400 @@
+/*
+    copy.c
+    Pipelined copy engine used to move chunk payloads between files
+
+    A reader thread fills a ring of large, aligned buffers while the
+    calling thread drains them to the output, so that the input and
+    output devices are kept busy at the same time.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "util.h"
+#include "copy.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+
+typedef struct {
+    uint8_t * buffer;       // Start of the aligned allocation
+    uint8_t * data;         // Start of the payload within buffer
+    size_t    len;          // Number of payload bytes
+} copy_slot_t;
+
+
+typedef struct {
+    int in_fd;
+    off_t in_offset;
+    uint64_t length;
+    size_t block_size;
+    int in_direct;
+    int out_direct;         // Only used by the writing thread
+    int align_payload;      // Fixed before the reader starts
+
+    copy_slot_t * slots;
+    int depth;
+    uint64_t produced;
+    uint64_t consumed;
+    int failed;             // The reader stopped on a read error
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+} copy_state_t;
+
+
+
+void
+copy_params_init( copy_params_t* params )
+{
+    params->buffer_size = COPY_DEFAULT_BUFFER_SIZE;
+    params->depth = COPY_DEFAULT_DEPTH;
+    params->direct = 0;
+    params->observer = NULL;
+    params->observer_arg = NULL;
+    params->sink = NULL;
+    params->sink_arg = NULL;
+    params->slots = NULL;
+    params->slot_count = 0;
+    params->slot_size = 0;
+}
+
+
+void
+copy_params_free( copy_params_t* params )
+{
+    copy_slot_t * slots = params->slots;
+    int n;
+
+    for (n=0; n<params->slot_count; n++)
+        free( slots[n].buffer );
+    free( slots );
+    params->slots = NULL;
+    params->slot_count = 0;
+}
+
+
+// Make sure there are enough buffers of the right size for a copy;
+// they are kept in params, so a run of copies only allocates them once
+static copy_slot_t*
+get_slots( copy_params_t* params, int depth, size_t block_size )
+{
+    copy_slot_t * slots;
+    int n;
+
+    if (params->slot_size != block_size) {
+        copy_params_free( params );
+        params->slot_size = block_size;
+    }
+
+    if (depth > params->slot_count) {
+        slots = realloc( params->slots, depth * sizeof(copy_slot_t) );
+        if (!slots) handle_error( "Unable to allocate memory for copy buffers." );
+        for (n=params->slot_count; n<depth; n++) {
+            void* buf = NULL;
+            if (posix_memalign( &buf, COPY_DIRECT_ALIGN, block_size + 2*COPY_DIRECT_ALIGN ))
+                handle_error( "Unable to allocate memory for copy buffers." );
+            slots[n].buffer = buf;
+        }
+        params->slots = slots;
+        params->slot_count = depth;
+    }
+
+    return params->slots;
+}
+
+
+// Parse a size such as '512k' or '4M'
+// Returns 0 if the string isn't a valid size
+size_t
+copy_parse_size( const char* str )
+{
+    char * end = NULL;
+    unsigned long size = strtoul( str, &end, 10 );
+
+    if (end == str) return 0;
+
+    switch (*end) {
+        case 'g': case 'G': size *= 1024;
+        /* fall through */
+        case 'm': case 'M': size *= 1024;
+        /* fall through */
+        case 'k': case 'K': size *= 1024; end++;
+        /* fall through */
+        case '\0': break;
+        default: return 0;
+    }
+
+    if (*end != '\0') return 0;
+
+    return size;
+}
+
+
+static int
+copy_open( const char* filename, int flags, const copy_params_t* params )
+{
+    int fd = -1;
+
+    if (params->direct && O_DIRECT) {
+        fd = open( filename, flags | O_DIRECT, 0666 );
+        if (fd < 0 && errno == EINVAL) {
+            // The filesystem doesn't support it; carry on without
+            fprintf(stderr, "Warning: O_DIRECT not supported for '%s'.\n", filename);
+        } else {
+            return fd;
+        }
+    }
+
+    return open( filename, flags, 0666 );
+}
+
+
+int
+copy_open_input( const char* filename, const copy_params_t* params )
+{
+    int fd = copy_open( filename, O_RDONLY, params );
+    if (fd < 0) return fd;
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    return fd;
+}
+
+
+int
+copy_open_output( const char* filename, const copy_params_t* params )
+{
+    return copy_open( filename, O_WRONLY | O_CREAT | O_TRUNC, params );
+}
+
+
+// Switch off O_DIRECT, before an unaligned read or write
+void
+copy_disable_direct( int fd )
+{
+    int flags = fcntl( fd, F_GETFL );
+    if (O_DIRECT && flags != -1 && (flags & O_DIRECT))
+        fcntl( fd, F_SETFL, flags & ~O_DIRECT );
+}
+
+
+static int
+is_direct( int fd )
+{
+    int flags = fcntl( fd, F_GETFL );
+    return (O_DIRECT && flags != -1 && (flags & O_DIRECT));
+}
+
+
+static size_t
+round_up( size_t x, size_t align )
+{
+    return (x + align - 1) & ~(align - 1);
+}
+
+
+// Read a block of the input into a slot
+// Returns 0 on success, or -1 on a read error
+static int
+read_block( copy_state_t* state, copy_slot_t* slot, uint64_t pos )
+{
+    off_t offset = state->in_offset + pos;
+    size_t len = state->block_size;
+    size_t head = 0;
+    size_t want, got = 0;
+
+    if (state->length - pos < len) len = state->length - pos;
+    want = len;
+
+    // O_DIRECT reads must start and end on aligned boundaries
+    if (state->in_direct) {
+        head = offset & (COPY_DIRECT_ALIGN-1);
+        offset -= head;
+        want = round_up( head + len, COPY_DIRECT_ALIGN );
+    }
+
+    while (got < head + len) {
+        ssize_t res = pread( state->in_fd, slot->buffer + got, want - got, offset + got );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+        got += res;
+    }
+
+    // O_DIRECT writes need the payload at the start of the buffer
+    if (head && state->align_payload) {
+        memmove( slot->buffer, slot->buffer + head, len );
+        head = 0;
+    }
+
+    slot->data = slot->buffer + head;
+    slot->len = len;
+    return 0;
+}
+
+
+static void*
+reader_thread( void* arg )
+{
+    copy_state_t* state = arg;
+    uint64_t pos;
+
+    for (pos = 0; pos < state->length; pos += state->block_size) {
+        copy_slot_t* slot;
+
+        // Wait for a free slot
+        pthread_mutex_lock( &state->lock );
+        while (state->produced - state->consumed == state->depth)
+            pthread_cond_wait( &state->not_full, &state->lock );
+        slot = &state->slots[ state->produced % state->depth ];
+        pthread_mutex_unlock( &state->lock );
+
+        // Errors are reported by the main thread, so that it isn't
+        // still writing while the process exits
+        if (read_block( state, slot, pos )) {
+            pthread_mutex_lock( &state->lock );
+            state->failed = 1;
+            pthread_cond_signal( &state->not_empty );
+            pthread_mutex_unlock( &state->lock );
+            break;
+        }
+
+        pthread_mutex_lock( &state->lock );
+        state->produced++;
+        pthread_cond_signal( &state->not_empty );
+        pthread_mutex_unlock( &state->lock );
+    }
+
+    return NULL;
+}
+
+
+// Copy length bytes, starting at in_offset, from in_fd to
+// the current position of out_fd (or to params->sink)
+void
+copy_range( int in_fd, off_t in_offset, int out_fd, uint64_t length,
+            copy_params_t* params )
+{
+    copy_state_t state;
+    pthread_t reader;
+    uint64_t blocks;
+
+    if (length == 0) return;
+
+    memset( &state, 0, sizeof(state) );
+    state.in_fd = in_fd;
+    state.in_offset = in_offset;
+    state.length = length;
+    state.in_direct = is_direct( in_fd );
+    state.out_direct = out_fd >= 0 && is_direct( out_fd );
+    state.block_size = round_up( params->buffer_size, COPY_DIRECT_ALIGN );
+    state.depth = params->depth < 1 ? 1 : params->depth;
+
+    // Don't allocate more buffers than there are blocks
+    blocks = (length + state.block_size - 1) / state.block_size;
+    if (blocks < state.depth) state.depth = blocks;
+
+    // The ring of buffers, with space for alignment slop
+    state.slots = get_slots( params, state.depth, state.block_size );
+
+    if (out_fd >= 0) {
+        off_t pos = lseek( out_fd, 0, SEEK_CUR );
+
+        // Something has already been written that wasn't aligned
+        if (state.out_direct && pos > 0 && (pos & (COPY_DIRECT_ALIGN-1))) {
+            copy_disable_direct( out_fd );
+            state.out_direct = 0;
+        }
+
+#ifdef HAVE_FALLOCATE
+        // Reserve space for the output up-front (ignored for pipes etc)
+        if (pos >= 0) fallocate( out_fd, 0, pos, length );
+#endif
+    }
+
+    // Decided once, as the writing thread may turn O_DIRECT off
+    // for the last block while the reader is still running
+    state.align_payload = state.out_direct;
+
+    pthread_mutex_init( &state.lock, NULL );
+    pthread_cond_init( &state.not_full, NULL );
+    pthread_cond_init( &state.not_empty, NULL );
+
+    if (pthread_create( &reader, NULL, reader_thread, &state ))
+        handle_error( "Unable to start reader thread." );
+
+    while (state.consumed < blocks) {
+        copy_slot_t* slot;
+
+        // Wait for the reader to fill a slot
+        pthread_mutex_lock( &state.lock );
+        while (state.consumed == state.produced && !state.failed)
+            pthread_cond_wait( &state.not_empty, &state.lock );
+        if (state.consumed == state.produced) {
+            pthread_mutex_unlock( &state.lock );
+            pthread_join( reader, NULL );
+            handle_error( "Unable to read from input file." );
+        }
+        slot = &state.slots[ state.consumed % state.depth ];
+        pthread_mutex_unlock( &state.lock );
+
+        // The final block may not be a multiple of the alignment
+        if (state.out_direct && (slot->len & (COPY_DIRECT_ALIGN-1))) {
+            copy_disable_direct( out_fd );
+            state.out_direct = 0;
+        }
+
+        if (params->observer)
+            params->observer( params->observer_arg, slot->data, slot->len );
+
+        if (params->sink)
+            params->sink( params->sink_arg, slot->data, slot->len );
+        else
+            write_bytes( out_fd, slot->data, slot->len );
+
+        pthread_mutex_lock( &state.lock );
+        state.consumed++;
+        pthread_cond_signal( &state.not_full );
+        pthread_mutex_unlock( &state.lock );
+    }
+
+    pthread_join( reader, NULL );
+
+    pthread_cond_destroy( &state.not_empty );
+    pthread_cond_destroy( &state.not_full );
+    pthread_mutex_destroy( &state.lock );
+}
@@ -0,0 +1,59 @@
+/*
+    copy.h
+    Pipelined copy engine used to move chunk payloads between files
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _COPY_H
+#define _COPY_H
+
+#define COPY_DEFAULT_BUFFER_SIZE   (1024*1024)
+#define COPY_DEFAULT_DEPTH         4
+#define COPY_DIRECT_ALIGN          4096
+
+
+// Called with each block of data, in order, before it is written
+typedef void (*copy_observer_t)( void* arg, const uint8_t* data, size_t len );
+
+typedef struct {
+    size_t buffer_size;     // Size of each buffer in the pipeline
+    int    depth;           // Number of buffers in flight
+    int    direct;          // Use O_DIRECT for input and output
+    copy_observer_t observer;
+    void * observer_arg;
+    copy_observer_t sink;   // If set, called instead of writing to the output
+    void * sink_arg;
+    void * slots;           // Buffers kept from one copy to the next
+    int    slot_count;
+    size_t slot_size;
+} copy_params_t;
+
+
+void copy_params_init( copy_params_t* params );
+void copy_params_free( copy_params_t* params );
+size_t copy_parse_size( const char* str );
+
+int copy_open_input( const char* filename, const copy_params_t* params );
+int copy_open_output( const char* filename, const copy_params_t* params );
+void copy_disable_direct( int fd );
+
+void copy_range( int in_fd, off_t in_offset, int out_fd, uint64_t length,
+                 copy_params_t* params );
+
+#endif //_COPY_H
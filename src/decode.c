@@ -0,0 +1,420 @@
+/*
+    decode.c
+    Decoding G.711 and ADPCM audio to 16-bit linear PCM
+
+    G.711 mu-law and A-law are expanded with 256 entry lookup tables.
+    IMA (DVI) and Microsoft ADPCM are decoded a block at a time.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "decode.h"
+
+
+static int16_t mulaw_table[256];
+static int16_t alaw_table[256];
+static int tables_ready = 0;
+
+static const int ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int ima_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int ms_adapt_table[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230
+};
+
+static const int ms_coef_table[7][2] = {
+    { 256, 0 }, { 512, -256 }, { 0, 0 }, { 192, 64 },
+    { 240, 0 }, { 460, -208 }, { 392, -232 }
+};
+
+
+
+static void
+build_tables()
+{
+    int n;
+
+    for (n=0; n<256; n++) {
+        int u = ~n & 0xFF;
+        int a = n ^ 0x55;
+        int t, seg;
+
+        // mu-law
+        t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+        mulaw_table[n] = (u & 0x80) ? (0x84 - t) : (t - 0x84);
+
+        // A-law
+        t = (a & 0x0F) << 4;
+        seg = (a & 0x70) >> 4;
+        if (seg == 0) t += 8;
+        else if (seg == 1) t += 0x108;
+        else t = (t + 0x108) << (seg - 1);
+        alaw_table[n] = (a & 0x80) ? t : -t;
+    }
+
+    tables_ready = 1;
+}
+
+
+static int16_t
+clamp16( int x )
+{
+    if (x > 32767) return 32767;
+    if (x < -32768) return -32768;
+    return x;
+}
+
+
+static int16_t
+read_int16( const uint8_t* p )
+{
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+
+
+// Decode an IMA ADPCM block (or as much of one as there is)
+// Returns the number of frames decoded
+static int
+decode_ima_block( decode_t* decode, const uint8_t* block, size_t len, int16_t* out )
+{
+    int channels = decode->channels;
+    int frames, c;
+
+    if (len < 4*channels) return 0;
+    frames = 1 + ((len - 4*channels) / (4*channels)) * 8;
+    if (frames > decode->samplesPerBlock) frames = decode->samplesPerBlock;
+
+    for (c=0; c<channels; c++) {
+        const uint8_t* header = block + 4*c;
+        const uint8_t* p = block + 4*channels + 4*c;
+        int predictor = read_int16( header );
+        int index = header[2];
+        int frame = 1;
+
+        if (index > 88) index = 88;
+        out[c] = predictor;
+
+        // Each channel has 4 bytes (8 samples) at a time, low nibble first
+        while (frame < frames) {
+            int b;
+            for (b=0; b<8 && frame < frames; b++, frame++) {
+                int nibble = (b & 1) ? (p[b>>1] >> 4) : (p[b>>1] & 0x0F);
+                int step = ima_step_table[index];
+                int diff = step >> 3;
+
+                if (nibble & 1) diff += step >> 2;
+                if (nibble & 2) diff += step >> 1;
+                if (nibble & 4) diff += step;
+                predictor = clamp16( (nibble & 8) ? predictor - diff : predictor + diff );
+
+                index += ima_index_table[nibble];
+                if (index < 0) index = 0;
+                if (index > 88) index = 88;
+
+                out[frame*channels + c] = predictor;
+            }
+            p += 4*channels;
+        }
+    }
+
+    return frames;
+}
+
+
+// Decode a Microsoft ADPCM block (or as much of one as there is)
+// Returns the number of frames decoded
+static int
+decode_ms_block( decode_t* decode, const uint8_t* block, size_t len, int16_t* out )
+{
+    int channels = decode->channels;
+    int coef1[2], coef2[2], delta[2], sample1[2], sample2[2];
+    const uint8_t* p;
+    int frames, n, c;
+
+    if (channels > 2 || len < 7*channels) return 0;
+    frames = 2 + ((len - 7*channels) * 2) / channels;
+    if (frames > decode->samplesPerBlock) frames = decode->samplesPerBlock;
+
+    // The block header has each field for all the channels in turn
+    for (c=0; c<channels; c++) {
+        int predictor = block[c];
+        if (predictor > 6) predictor = 0;
+        coef1[c] = ms_coef_table[predictor][0];
+        coef2[c] = ms_coef_table[predictor][1];
+        delta[c] = read_int16( block + channels + 2*c );
+        sample1[c] = read_int16( block + 3*channels + 2*c );
+        sample2[c] = read_int16( block + 5*channels + 2*c );
+        out[c] = sample2[c];
+        out[channels + c] = sample1[c];
+    }
+
+    // Then nibbles for each channel in turn, high nibble first
+    p = block + 7*channels;
+    for (n=2*channels; n<frames*channels; n++) {
+        int nibble = (n & 1) ? (*p++ & 0x0F) : (*p >> 4);
+        int signedNibble = nibble & 8 ? nibble - 16 : nibble;
+        int sample;
+
+        c = n % channels;
+        sample = ((sample1[c] * coef1[c]) + (sample2[c] * coef2[c])) >> 8;
+        sample = clamp16( sample + signedNibble * delta[c] );
+        sample2[c] = sample1[c];
+        sample1[c] = sample;
+
+        delta[c] = (ms_adapt_table[nibble] * delta[c]) >> 8;
+        if (delta[c] < 16) delta[c] = 16;
+
+        out[n] = sample;
+    }
+
+    return frames;
+}
+
+
+
+// Check if this format can be decoded
+int
+decode_supported( const wave_format_t* fmt )
+{
+    switch (fmt->audioFormat) {
+        case WAVE_FORMAT_MULAW:
+        case WAVE_FORMAT_ALAW:
+        case WAVE_FORMAT_G711_MULAW:
+        case WAVE_FORMAT_G711_ALAW:
+            return fmt->channels > 0;
+        case WAVE_FORMAT_IMA_ADPCM:
+            return fmt->channels > 0 && fmt->blockAlign > 4*fmt->channels &&
+                   (fmt->blockAlign % (4*fmt->channels)) == 0;
+        case WAVE_FORMAT_MS_ADPCM:
+            return (fmt->channels == 1 || fmt->channels == 2) &&
+                   fmt->blockAlign > 7*fmt->channels;
+    }
+    return 0;
+}
+
+
+static int
+samples_per_block( const wave_format_t* fmt )
+{
+    int spb = 1;
+
+    if (fmt->audioFormat == WAVE_FORMAT_IMA_ADPCM)
+        spb = 1 + ((fmt->blockAlign - 4*fmt->channels) / (4*fmt->channels)) * 8;
+    else if (fmt->audioFormat == WAVE_FORMAT_MS_ADPCM)
+        spb = 2 + ((fmt->blockAlign - 7*fmt->channels) * 2) / fmt->channels;
+
+    // Trust the fmt chunk if it is smaller
+    if (fmt->samplesPerBlock && fmt->samplesPerBlock < spb)
+        spb = fmt->samplesPerBlock;
+
+    return spb;
+}
+
+
+// Work out how many frames the decoded audio will have
+uint64_t
+decode_frames( const wave_format_t* fmt, uint32_t dataSize, uint32_t factSamples )
+{
+    uint64_t frames;
+    uint32_t partial;
+
+    if (fmt->audioFormat != WAVE_FORMAT_IMA_ADPCM &&
+        fmt->audioFormat != WAVE_FORMAT_MS_ADPCM)
+        return dataSize / fmt->channels;
+
+    frames = (uint64_t)(dataSize / fmt->blockAlign) * samples_per_block( fmt );
+
+    // A short final block
+    partial = dataSize % fmt->blockAlign;
+    if (fmt->audioFormat == WAVE_FORMAT_IMA_ADPCM && partial >= 4*fmt->channels)
+        frames += 1 + ((partial - 4*fmt->channels) / (4*fmt->channels)) * 8;
+    else if (fmt->audioFormat == WAVE_FORMAT_MS_ADPCM && partial >= 7*fmt->channels)
+        frames += 2 + ((partial - 7*fmt->channels) * 2) / fmt->channels;
+
+    // The fact chunk says how many samples are really there
+    if (factSamples && factSamples < frames) frames = factSamples;
+
+    return frames;
+}
+
+
+
+static void
+decode_flush( decode_t* decode )
+{
+#ifdef WORDS_BIGENDIAN
+    size_t n;
+    for (n=0; n<decode->outFill; n++)
+        decode->out[n] = my_swap16( decode->out[n] );
+#endif
+    write_bytes( decode->out_fd, decode->out, decode->outFill * sizeof(int16_t) );
+    decode->outFill = 0;
+}
+
+
+// Account for frames added to the output buffer
+static void
+decode_output( decode_t* decode, size_t frames )
+{
+    size_t samples = frames * decode->channels;
+
+    if (samples > decode->samplesLeft) samples = decode->samplesLeft;
+    decode->samplesLeft -= samples;
+    decode->outFill += samples;
+
+    if (decode->outCapacity - decode->outFill < (size_t)decode->samplesPerBlock * decode->channels)
+        decode_flush( decode );
+}
+
+
+void
+decode_open( decode_t* decode, const wave_format_t* fmt, uint64_t frames, int out_fd )
+{
+    if (!tables_ready) build_tables();
+
+    memset( decode, 0, sizeof(decode_t) );
+    decode->format = fmt->audioFormat;
+    decode->channels = fmt->channels;
+    decode->out_fd = out_fd;
+    decode->samplesLeft = frames * fmt->channels;
+
+    if (fmt->audioFormat == WAVE_FORMAT_IMA_ADPCM || fmt->audioFormat == WAVE_FORMAT_MS_ADPCM) {
+        decode->blockAlign = fmt->blockAlign;
+        decode->samplesPerBlock = samples_per_block( fmt );
+    } else {
+        // G.711 samples are independent, so decode any number of them
+        decode->blockAlign = 1;
+        decode->samplesPerBlock = 1;
+        if (fmt->audioFormat == WAVE_FORMAT_MULAW || fmt->audioFormat == WAVE_FORMAT_G711_MULAW)
+            decode->table = mulaw_table;
+        else
+            decode->table = alaw_table;
+    }
+
+    decode->outCapacity = DECODE_BUFFER_SIZE;
+    if (decode->outCapacity < (size_t)decode->samplesPerBlock * decode->channels * 2)
+        decode->outCapacity = (size_t)decode->samplesPerBlock * decode->channels * 2;
+    decode->out = malloc( decode->outCapacity * sizeof(int16_t) );
+    decode->partial = malloc( decode->blockAlign );
+    if (!decode->out || !decode->partial)
+        handle_error( "Unable to allocate memory for decoder." );
+}
+
+
+static void
+decode_block( decode_t* decode, const uint8_t* block, size_t len )
+{
+    int16_t* out = decode->out + decode->outFill;
+    int frames;
+
+    if (decode->format == WAVE_FORMAT_IMA_ADPCM)
+        frames = decode_ima_block( decode, block, len, out );
+    else
+        frames = decode_ms_block( decode, block, len, out );
+
+    decode_output( decode, frames );
+}
+
+
+// Copy engine sink: decode the next block of the data chunk
+void
+decode_feed( void* arg, const uint8_t* data, size_t len )
+{
+    decode_t* decode = arg;
+
+    if (decode->table) {
+        // G.711: one byte per sample, one table lookup each
+        while (len && decode->samplesLeft) {
+            size_t room = decode->outCapacity - decode->outFill;
+            size_t n = len < room ? len : room;
+            int16_t* out = decode->out + decode->outFill;
+            size_t i;
+
+            if (n > decode->samplesLeft) n = decode->samplesLeft;
+            for (i=0; i<n; i++) out[i] = decode->table[ data[i] ];
+
+            decode->samplesLeft -= n;
+            decode->outFill += n;
+            data += n;
+            len -= n;
+            if (decode->outFill == decode->outCapacity) decode_flush( decode );
+        }
+        return;
+    }
+
+    // Complete a block left over from the previous buffer
+    if (decode->partialLen) {
+        size_t take = decode->blockAlign - decode->partialLen;
+        if (take > len) take = len;
+        memcpy( decode->partial + decode->partialLen, data, take );
+        decode->partialLen += take;
+        data += take;
+        len -= take;
+
+        if (decode->partialLen < decode->blockAlign) return;
+        decode_block( decode, decode->partial, decode->blockAlign );
+        decode->partialLen = 0;
+    }
+
+    while (len >= decode->blockAlign) {
+        decode_block( decode, data, decode->blockAlign );
+        data += decode->blockAlign;
+        len -= decode->blockAlign;
+    }
+
+    memcpy( decode->partial, data, len );
+    decode->partialLen = len;
+}
+
+
+void
+decode_close( decode_t* decode )
+{
+    // Decode what there is of a short final block
+    if (decode->partialLen)
+        decode_block( decode, decode->partial, decode->partialLen );
+
+    decode_flush( decode );
+
+    free( decode->out );
+    free( decode->partial );
+}
@@ -0,0 +1,52 @@
+/*
+    decode.h
+    Decoding G.711 and ADPCM audio to 16-bit linear PCM
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#define DECODE_BUFFER_SIZE  (256*1024)
+
+
+typedef struct {
+    uint16_t format;
+    int channels;
+    int blockAlign;         // Bytes of input decoded at a time
+    int samplesPerBlock;    // Frames of output per block
+    const int16_t * table;  // Expansion table for G.711
+    int out_fd;
+    uint64_t samplesLeft;   // Samples still to be written
+    uint8_t * partial;      // Block split across two input blocks
+    size_t partialLen;
+    int16_t * out;
+    size_t outFill;         // Samples in the output buffer
+    size_t outCapacity;
+} decode_t;
+
+
+int decode_supported( const wave_format_t* fmt );
+uint64_t decode_frames( const wave_format_t* fmt, uint32_t dataSize, uint32_t factSamples );
+
+void decode_open( decode_t* decode, const wave_format_t* fmt, uint64_t frames, int out_fd );
+void decode_feed( void* decode, const uint8_t* data, size_t len );
+void decode_close( decode_t* decode );
+
+#endif //_DECODE_H
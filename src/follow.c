@@ -0,0 +1,261 @@
+/*
+    follow.c
+    Streaming the audio of a WAVE file which is still being recorded
+
+    While a file is being recorded, the RIFF and 'data' chunk sizes
+    are usually zero or out of date, so the data chunk is treated as
+    running to the end of the file. New audio is copied to the output
+    as it arrives, waiting on inotify in between. We stop when the
+    writer closes (or renames) the file, or when the header has been
+    finalised and the file has stopped growing.
+
+    Recorders often append chunks such as LIST or cart after the audio
+    just before finalising the header, so the last few kilobytes are
+    held back until more audio arrives or the file goes quiet.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "util.h"
+#include "follow.h"
+
+
+typedef struct {
+    int fd;
+    int notify_fd;          // inotify instance, or -1
+    int closed;             // The writer has closed, renamed or deleted the file
+    off_t lastSize;         // Used to detect growth without inotify
+} follow_t;
+
+
+static off_t
+follow_size( follow_t* follow )
+{
+    struct stat fileInfo;
+    if (fstat( follow->fd, &fileInfo )) handle_error("unable to stat file");
+    return fileInfo.st_size;
+}
+
+
+static uint32_t
+read_uint32_at( follow_t* follow, off_t offset )
+{
+    uint8_t buf[4];
+
+    if (pread( follow->fd, buf, sizeof(buf), offset ) != sizeof(buf))
+        return 0;
+
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+// Wait for the file to change
+// Returns 1 if it changed, or 0 if timeout_ms passed first (-1 waits forever)
+static int
+follow_wait( follow_t* follow, int timeout_ms )
+{
+    int waited = 0;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    if (follow->notify_fd >= 0) {
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        struct pollfd pfd;
+        ssize_t len, n;
+        int res;
+
+        pfd.fd = follow->notify_fd;
+        pfd.events = POLLIN;
+        res = poll( &pfd, 1, timeout_ms );
+        if (res < 0 && errno == EINTR) return 1;
+        if (res < 0) handle_error("unable to wait for file to change");
+        if (res == 0) return 0;
+
+        len = read( follow->notify_fd, buf, sizeof(buf) );
+        for (n=0; n<len; ) {
+            const struct inotify_event* event = (const struct inotify_event*)(buf+n);
+            if (event->mask & (IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF))
+                follow->closed = 1;
+            n += sizeof(struct inotify_event) + event->len;
+        }
+
+        return 1;
+    }
+#endif
+
+    // No inotify: check for growth every so often
+    for (;;) {
+        off_t size;
+
+        usleep( FOLLOW_POLL_MS * 1000 );
+        waited += FOLLOW_POLL_MS;
+
+        size = follow_size( follow );
+        if (size != follow->lastSize) {
+            follow->lastSize = size;
+            return 1;
+        }
+        if (timeout_ms >= 0 && waited >= timeout_ms) return 0;
+    }
+}
+
+
+static int
+idle_wait( follow_t* follow, int idleTimeout )
+{
+    return follow_wait( follow, idleTimeout > 0 ? idleTimeout*1000 : -1 );
+}
+
+
+// Wait for the header of the data chunk to be written
+// Returns the offset of the start of the data chunk payload
+static uint32_t
+follow_find_data( follow_t* follow, int idleTimeout )
+{
+    uint32_t seek = 12;
+    int checked = 0;
+
+    for (;;) {
+        off_t size = follow_size( follow );
+
+        if (!checked && size >= 12) {
+            char header[12];
+            if (pread( follow->fd, header, sizeof(header), 0 ) != sizeof(header))
+                handle_error("unable to read chunk type");
+            if (memcmp("RIFF", header, 4)!=0 || memcmp("WAVE", header+8, 4)!=0)
+                handle_error("input is not a RIFF/WAVE file");
+            checked = 1;
+        }
+
+        while (checked && seek+8 <= size) {
+            char type[4];
+
+            if (pread( follow->fd, type, sizeof(type), seek ) != sizeof(type))
+                handle_error("unable to read sub chunk type");
+
+            // skip a byte if the sub-chunk type starts with a null byte
+            if (type[0] == 0) {
+                ++seek;
+            } else if (memcmp("data", type, sizeof(type))==0) {
+                return seek+8;
+            } else {
+                seek += 8 + read_uint32_at( follow, seek+4 );
+            }
+        }
+
+        if (follow->closed) handle_error("no data chunk found");
+        if (!idle_wait( follow, idleTimeout )) handle_error("timed out waiting for data chunk");
+    }
+}
+
+
+// Copy the data chunk of a file that may still be being written
+void
+follow_data_chunk( const char* filename, int out_fd, int idleTimeout )
+{
+    follow_t follow;
+    uint8_t * buffer = malloc( FOLLOW_BUFFER_SIZE );
+    uint32_t dataSeek;
+    off_t pos;
+    int quiet = 0;
+
+    if (!buffer) handle_error("Unable to allocate memory for read buffer.");
+
+    memset( &follow, 0, sizeof(follow) );
+    follow.fd = open( filename, O_RDONLY );
+    if (follow.fd < 0) handle_error("unable to open input file");
+    follow.notify_fd = -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    // Start watching before the first read, so that no change is missed
+    follow.notify_fd = inotify_init();
+    if (follow.notify_fd >= 0 &&
+        inotify_add_watch( follow.notify_fd, filename,
+                           IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF ) < 0) {
+        close( follow.notify_fd );
+        follow.notify_fd = -1;
+    }
+    if (follow.notify_fd < 0)
+        fprintf(stderr, "Warning: inotify not available; polling for changes.\n");
+#endif
+    follow.lastSize = follow_size( &follow );
+
+    dataSeek = follow_find_data( &follow, idleTimeout );
+    pos = dataSeek;
+
+    for (;;) {
+        off_t size = follow_size( &follow );
+        uint32_t riffSize = read_uint32_at( &follow, 4 );
+        uint32_t dataSize = read_uint32_at( &follow, dataSeek-4 );
+        off_t dataEnd = (off_t)dataSeek + dataSize;
+        off_t end = size;
+
+        // A finalised header describes the whole of the file
+        int final = (dataSize != 0 && dataSize != 0xFFFFFFFF &&
+                     dataEnd <= size && (off_t)riffSize+8 >= size);
+
+        if (!quiet && !follow.closed)
+            end = size - FOLLOW_HOLDBACK;
+
+        // Don't copy anything that comes after the data chunk
+        if (final && end > dataEnd)
+            end = dataEnd;
+
+        while (pos < end) {
+            size_t len = end-pos < FOLLOW_BUFFER_SIZE ? end-pos : FOLLOW_BUFFER_SIZE;
+            ssize_t res = pread( follow.fd, buffer, len, pos );
+            if (res < 0 && errno == EINTR) continue;
+            if (res <= 0) handle_error("Unable to read from input file.");
+            write_bytes( out_fd, buffer, res );
+            pos += res;
+        }
+
+        if (follow.closed || (final && quiet)) break;
+
+        // With a final looking header or bytes held back,
+        // only wait a short time for more
+        if (final || pos < size) {
+            quiet = !follow_wait( &follow, FOLLOW_SETTLE_MS );
+        } else if (idle_wait( &follow, idleTimeout )) {
+            quiet = 0;
+        } else {
+            fprintf(stderr, "Warning: no new audio for %d seconds; stopping.\n", idleTimeout);
+            break;
+        }
+    }
+
+    if (follow.notify_fd >= 0) close( follow.notify_fd );
+    close( follow.fd );
+    free( buffer );
+}
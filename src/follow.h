@@ -0,0 +1,34 @@
+/*
+    follow.h
+    Streaming the audio of a WAVE file which is still being recorded
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _FOLLOW_H
+#define _FOLLOW_H
+
+#define FOLLOW_BUFFER_SIZE   (256*1024)
+#define FOLLOW_HOLDBACK      8192       // Bytes held back in case they are a trailing chunk
+#define FOLLOW_SETTLE_MS     500        // Quiet time before trusting a final header
+#define FOLLOW_POLL_MS       100        // Only used without inotify
+
+
+void follow_data_chunk( const char* filename, int out_fd, int idleTimeout );
+
+#endif //_FOLLOW_H
@@ -0,0 +1,173 @@
+/*
+    hash.c
+    Fast non-cryptographic hashing (XXH64) of audio payloads
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "hash.h"
+
+
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3  1609587929392839161ULL
+#define PRIME64_4  9650029242287828579ULL
+#define PRIME64_5  2870177450012600261ULL
+
+
+static uint64_t rotl64( uint64_t x, int r ) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64( const uint8_t* p ) {
+    uint64_t x;
+    memcpy( &x, p, sizeof(x) );
+#ifdef WORDS_BIGENDIAN
+    x = ((uint64_t)my_swap32( (uint32_t)x ) << 32) | my_swap32( (uint32_t)(x >> 32) );
+#endif
+    return x;
+}
+
+static uint32_t read32( const uint8_t* p ) {
+    uint32_t x;
+    memcpy( &x, p, sizeof(x) );
+#ifdef WORDS_BIGENDIAN
+    x = my_swap32( x );
+#endif
+    return x;
+}
+
+static uint64_t hash_round( uint64_t acc, uint64_t input ) {
+    acc += input * PRIME64_2;
+    acc = rotl64( acc, 31 );
+    return acc * PRIME64_1;
+}
+
+static uint64_t hash_merge( uint64_t acc, uint64_t val ) {
+    acc ^= hash_round( 0, val );
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+void
+hash_init( hash_state_t* state )
+{
+    memset( state, 0, sizeof(hash_state_t) );
+    state->v[0] = PRIME64_1 + PRIME64_2;
+    state->v[1] = PRIME64_2;
+    state->v[2] = 0;
+    state->v[3] = -PRIME64_1;
+}
+
+
+void
+hash_update( hash_state_t* state, const void* data, size_t len )
+{
+    const uint8_t* p = data;
+    const uint8_t* end = p + len;
+
+    state->total_len += len;
+
+    // Not enough for a full stripe yet
+    if (state->memsize + len < 32) {
+        memcpy( state->mem + state->memsize, p, len );
+        state->memsize += len;
+        return;
+    }
+
+    // Complete the buffered stripe
+    if (state->memsize) {
+        memcpy( state->mem + state->memsize, p, 32 - state->memsize );
+        p += 32 - state->memsize;
+        state->v[0] = hash_round( state->v[0], read64( state->mem ) );
+        state->v[1] = hash_round( state->v[1], read64( state->mem + 8 ) );
+        state->v[2] = hash_round( state->v[2], read64( state->mem + 16 ) );
+        state->v[3] = hash_round( state->v[3], read64( state->mem + 24 ) );
+        state->memsize = 0;
+    }
+
+    // Process whole stripes straight from the input
+    while (p + 32 <= end) {
+        state->v[0] = hash_round( state->v[0], read64( p ) );
+        state->v[1] = hash_round( state->v[1], read64( p + 8 ) );
+        state->v[2] = hash_round( state->v[2], read64( p + 16 ) );
+        state->v[3] = hash_round( state->v[3], read64( p + 24 ) );
+        p += 32;
+    }
+
+    // Keep the remainder for next time
+    if (p < end) {
+        memcpy( state->mem, p, end - p );
+        state->memsize = end - p;
+    }
+}
+
+
+uint64_t
+hash_digest( const hash_state_t* state )
+{
+    const uint8_t* p = state->mem;
+    const uint8_t* end = p + state->memsize;
+    uint64_t h;
+
+    if (state->total_len >= 32) {
+        h = rotl64( state->v[0], 1 ) + rotl64( state->v[1], 7 ) +
+            rotl64( state->v[2], 12 ) + rotl64( state->v[3], 18 );
+        h = hash_merge( h, state->v[0] );
+        h = hash_merge( h, state->v[1] );
+        h = hash_merge( h, state->v[2] );
+        h = hash_merge( h, state->v[3] );
+    } else {
+        h = state->v[2] + PRIME64_5;
+    }
+
+    h += state->total_len;
+
+    while (p + 8 <= end) {
+        h ^= hash_round( 0, read64( p ) );
+        h = rotl64( h, 27 ) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32( p ) * PRIME64_1;
+        h = rotl64( h, 23 ) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64( h, 11 ) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
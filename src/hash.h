@@ -0,0 +1,38 @@
+/*
+    hash.h
+    Fast non-cryptographic hashing (XXH64) of audio payloads
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _HASH_H
+#define _HASH_H
+
+typedef struct {
+    uint64_t total_len;
+    uint64_t v[4];
+    uint8_t  mem[32];
+    uint32_t memsize;
+} hash_state_t;
+
+
+void hash_init( hash_state_t* state );
+void hash_update( hash_state_t* state, const void* data, size_t len );
+uint64_t hash_digest( const hash_state_t* state );
+
+#endif //_HASH_H
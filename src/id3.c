@@ -0,0 +1,149 @@
+/*
+    id3.c
+    Building ID3v2.3 tags for MPEG Audio files
+
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "id3.h"
+
+
+#define ID3_HEADER_SIZE     10
+
+
+static void
+append( id3_tag_t* tag, const void* data, size_t len )
+{
+    if (tag->len + len > tag->alloc) {
+        while (tag->len + len > tag->alloc) tag->alloc *= 2;
+        tag->data = realloc( tag->data, tag->alloc );
+        if (!tag->data) handle_error("unable to allocate memory for ID3 tag");
+    }
+    memcpy( tag->data + tag->len, data, len );
+    tag->len += len;
+}
+
+
+static void
+put_syncsafe( uint8_t* p, uint32_t x )
+{
+    p[0] = (x >> 21) & 0x7F;
+    p[1] = (x >> 14) & 0x7F;
+    p[2] = (x >> 7) & 0x7F;
+    p[3] = x & 0x7F;
+}
+
+
+void
+id3_init( id3_tag_t* tag )
+{
+    tag->alloc = 1024;
+    tag->len = ID3_HEADER_SIZE;
+    tag->data = calloc( 1, tag->alloc );
+    if (!tag->data) handle_error("unable to allocate memory for ID3 tag");
+}
+
+
+// Add a text frame. The spec is a frame ID, followed for TXXX
+// by a description, or for COMM by a language and description,
+// separated by commas: 'TIT2', 'TXXX,Intro' or 'COMM,eng,'
+void
+id3_add_frame( id3_tag_t* tag, const char* spec, const char* value )
+{
+    const char * desc = NULL;
+    const char * lang = NULL;
+    size_t start = tag->len;
+    uint32_t size;
+    uint8_t header[ID3_HEADER_SIZE];
+    uint8_t encoding = 0;       // ISO-8859-1
+
+    if (strlen(spec) < 4) return;
+    if (spec[4] == ',') desc = spec + 5;
+    if (memcmp( spec, "COMM", 4 )==0 && desc && strlen(desc) >= 4 && desc[3] == ',') {
+        lang = desc;
+        desc = desc + 4;
+    }
+
+    memset( header, 0, sizeof(header) );
+    memcpy( header, spec, 4 );
+    append( tag, header, sizeof(header) );
+
+    append( tag, &encoding, 1 );
+    if (lang) append( tag, lang, 3 );
+    if (desc) {
+        append( tag, desc, strlen(desc) );
+        append( tag, "", 1 );
+    }
+    append( tag, value, strlen(value) );
+
+    // Frame sizes in ID3v2.3 are plain big-endian integers
+    size = tag->len - start - ID3_HEADER_SIZE;
+    tag->data[start+4] = size >> 24;
+    tag->data[start+5] = size >> 16;
+    tag->data[start+6] = size >> 8;
+    tag->data[start+7] = size;
+}
+
+
+// Fill in the tag header, once all the frames have been added
+void
+id3_finish( id3_tag_t* tag )
+{
+    uint8_t * h = tag->data;
+
+    memcpy( h, "ID3", 3 );
+    h[3] = 3;       // Version 2.3.0
+    h[4] = 0;
+    h[5] = 0;       // No flags
+    put_syncsafe( h+6, tag->len - ID3_HEADER_SIZE );
+}
+
+
+void
+id3_free( id3_tag_t* tag )
+{
+    free( tag->data );
+    tag->data = NULL;
+}
+
+
+// Size of the ID3v2 tag that starts at header, including any footer,
+// or 0 if it doesn't start with a tag
+size_t
+id3_v2_size( const uint8_t* header, size_t len )
+{
+    size_t size;
+
+    if (len < ID3_HEADER_SIZE || memcmp( header, "ID3", 3 )!=0) return 0;
+    if (header[3] == 0xFF || header[4] == 0xFF) return 0;
+    if ((header[6] | header[7] | header[8] | header[9]) & 0x80) return 0;
+
+    size = ((size_t)header[6] << 21) | (header[7] << 14) | (header[8] << 7) | header[9];
+    size += ID3_HEADER_SIZE;
+    if (header[5] & 0x10) size += ID3_HEADER_SIZE;     // Footer present
+    return size;
+}
@@ -0,0 +1,41 @@
+/*
+    id3.h
+    Building ID3v2.3 tags for MPEG Audio files
+
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _ID3_H
+#define _ID3_H
+
+typedef struct {
+    uint8_t * data;         // Complete tag, including the 10 byte header
+    size_t len;
+    size_t alloc;
+} id3_tag_t;
+
+
+void id3_init( id3_tag_t* tag );
+void id3_add_frame( id3_tag_t* tag, const char* spec, const char* value );
+void id3_finish( id3_tag_t* tag );
+void id3_free( id3_tag_t* tag );
+
+size_t id3_v2_size( const uint8_t* header, size_t len );
+
+#endif //_ID3_H
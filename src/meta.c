@@ -0,0 +1,292 @@
+/*
+    meta.c
+    Reading the metadata of a WAVE file as wavemetainfo style key/values
+
+    Unlike wavemetainfo, a damaged file is reported to the caller
+    rather than ending the program, so that it can be used when
+    processing many files.
+
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "arena.h"
+#include "meta.h"
+
+
+#define META_MAX_TEXT       (64*1024)
+#define CF_TEXT             1
+
+// Variable length fields at the end of a cart chunk
+#define CART_URL_OFFSET     1024
+#define CART_URL_SIZE       1024
+#define CART_TAGTEXT_OFFSET 2048
+
+
+static uint32_t
+get_uint32( const uint8_t* p )
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t
+get_uint16( const uint8_t* p )
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+// Add an item whose value is already in the arena
+static void
+add_item( meta_info_t* info, const char* key, char* value )
+{
+    meta_item_t* item;
+
+    if (info->count == info->alloc) {
+        info->alloc = info->alloc ? info->alloc * 2 : 32;
+        info->items = realloc( info->items, info->alloc * sizeof(meta_item_t) );
+        if (!info->items) handle_error("unable to allocate memory for metadata");
+    }
+
+    item = &info->items[ info->count++ ];
+    snprintf( item->key, sizeof(item->key), "%s", key );
+    item->value = value;
+}
+
+
+// Add a value of at most len bytes, which is terminated in place when it
+// has room; only a value which fills its field completely is copied
+static void
+add_text( meta_info_t* info, const char* key, uint8_t* text, uint32_t len, int canTerminate )
+{
+    size_t n = strnlen( (const char*)text, len );
+
+    if (n == len && !canTerminate) {
+        char * copy = arena_alloc( &info->arena, len+1 );
+        memcpy( copy, text, len );
+        text = (uint8_t*)copy;
+    }
+    text[n] = 0;
+    add_item( info, key, (char*)text );
+}
+
+
+// Read a chunk payload into the arena, with room for a terminating NULL
+// Returns NULL if it couldn't be read
+static uint8_t*
+read_chunk( meta_info_t* info, FILE* file, uint32_t seek, uint32_t size )
+{
+    uint8_t * data;
+
+    if (size > META_MAX_TEXT) return NULL;
+    if (fseek( file, seek, SEEK_SET )!=0) return NULL;
+    data = arena_alloc( &info->arena, size+1 );
+    if (size && fread( data, size, 1, file )!=1) return NULL;
+    data[size] = 0;
+    return data;
+}
+
+
+static void
+read_list( meta_info_t* info, uint8_t* data, uint32_t size )
+{
+    uint32_t pos = 4;
+
+    if (size < 4 || memcmp( data, "INFO", 4 )!=0) return;
+
+    while (pos + 8 <= size) {
+        uint32_t subSize = get_uint32( data+pos+4 );
+        char key[10] = "info-";
+        int i;
+
+        if (subSize > size - pos - 8) break;
+
+        // Lowercase, as wavemetainfo does
+        for (i=0; i<4; i++) {
+            char c = data[pos+i];
+            if (c >= 'A' && c <= 'Z') c += 0x20;
+            else if (c < 0x40 || c > 0x7E) c = '?';
+            key[5+i] = c;
+        }
+        key[9] = 0;
+
+        // A value can be terminated in its pad byte, or after the chunk
+        add_text( info, key, data+pos+8, subSize,
+                  (subSize & 1) || pos + 8 + subSize == size );
+
+        // Sub-chunks are padded to an even length
+        pos += 8 + subSize + (subSize & 1);
+    }
+}
+
+
+static void
+read_cart( meta_info_t* info, uint8_t* data, uint32_t size )
+{
+    if (size < CART_URL_OFFSET + CART_URL_SIZE) return;
+
+    add_text( info, "cart-url", data + CART_URL_OFFSET, CART_URL_SIZE,
+              size == CART_URL_OFFSET + CART_URL_SIZE );
+    if (size > CART_TAGTEXT_OFFSET) {
+        add_text( info, "cart-tagtext", data + CART_TAGTEXT_OFFSET,
+                  size - CART_TAGTEXT_OFFSET, 1 );
+    }
+}
+
+
+void
+meta_init( meta_info_t* info )
+{
+    memset( info, 0, sizeof(meta_info_t) );
+    arena_init( &info->arena, 0 );
+}
+
+
+// Forget the previous file, keeping the memory for the next one
+static void
+meta_reset( meta_info_t* info )
+{
+    memset( &info->format, 0, sizeof(info->format) );
+    info->dataSeek = 0;
+    info->dataSize = 0;
+    info->count = 0;
+    arena_reset( &info->arena );
+}
+
+
+// Read the format, data chunk position and text metadata of a WAVE file
+// The strings are only valid until the next file is read into info
+// Returns 0 on success, or -1 if there is no fmt or data chunk
+int
+meta_read( FILE* file, meta_info_t* info )
+{
+    uint8_t header[12];
+    uint32_t seek = 12, end;
+    int haveFormat = 0, haveData = 0;
+
+    meta_reset( info );
+
+    if (fseek( file, 0, SEEK_SET )!=0 || fread( header, sizeof(header), 1, file )!=1)
+        return -1;
+    if (memcmp( header, "RIFF", 4 )!=0 || memcmp( header+8, "WAVE", 4 )!=0)
+        return -1;
+    end = 8 + get_uint32( header+4 );
+
+    while (seek + 8 <= end) {
+        uint8_t sub[8];
+        uint32_t size;
+        uint8_t * data = NULL;
+
+        // Skip the odd NULL bytes found after some chunks
+        if (fseek( file, seek, SEEK_SET )!=0 || fread( sub, sizeof(sub), 1, file )!=1) break;
+        if (sub[0] == 0) {
+            seek++;
+            continue;
+        }
+        size = get_uint32( sub+4 );
+
+        if (memcmp( sub, "data", 4 )==0) {
+            info->dataSeek = seek+8;
+            info->dataSize = size;
+            haveData = 1;
+        } else if (memcmp( sub, "fmt ", 4 )==0 && size >= 16 &&
+                   (data = read_chunk( info, file, seek+8, size ))) {
+            info->format.audioFormat = get_uint16( data );
+            info->format.channels = get_uint16( data+2 );
+            info->format.sampleRate = get_uint32( data+4 );
+            info->format.byteRate = get_uint32( data+8 );
+            info->format.blockAlign = get_uint16( data+12 );
+            info->format.sampleSize = get_uint16( data+14 );
+            haveFormat = 1;
+        } else if (memcmp( sub, "LIST", 4 )==0 && (data = read_chunk( info, file, seek+8, size ))) {
+            read_list( info, data, size );
+        } else if (memcmp( sub, "DISP", 4 )==0 && size > 4 &&
+                   (data = read_chunk( info, file, seek+8, size ))) {
+            if (get_uint32( data ) == CF_TEXT)
+                add_text( info, "disp-title", data+4, size-4, 1 );
+        } else if (memcmp( sub, "cart", 4 )==0 && (data = read_chunk( info, file, seek+8, size ))) {
+            read_cart( info, data, size );
+        }
+
+        if (seek + 8 + size < seek) break;
+        seek += 8 + size;
+    }
+
+    return (haveFormat && haveData) ? 0 : -1;
+}
+
+
+// Read 'key: value' lines, as written by wavemetainfo
+void
+meta_load_text( FILE* file, meta_info_t* info )
+{
+    char line[8192];
+
+    meta_reset( info );
+
+    while (fgets( line, sizeof(line), file )) {
+        size_t keyLen = strspn( line, "abcdefghijklmnopqrstuvwxyz"
+                                      "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_" );
+        char key[32];
+        char * value;
+
+        line[ strcspn(line, "\r\n") ] = 0;
+        if (keyLen == 0 || keyLen >= sizeof(key) || strncmp( line+keyLen, ": ", 2 )!=0)
+            continue;
+
+        memcpy( key, line, keyLen );
+        key[keyLen] = 0;
+        value = arena_alloc( &info->arena, strlen(line+keyLen+2) + 1 );
+        strcpy( value, line + keyLen + 2 );
+        add_item( info, key, value );
+    }
+}
+
+
+// Look up a value; returns NULL if the file doesn't have it
+// (the last one wins if a key appears more than once)
+const char*
+meta_get( const meta_info_t* info, const char* key )
+{
+    int n;
+
+    for (n=info->count-1; n>=0; n--) {
+        if (strcmp( info->items[n].key, key )==0) return info->items[n].value;
+    }
+    return NULL;
+}
+
+
+void
+meta_free( meta_info_t* info )
+{
+    arena_free( &info->arena );
+    free( info->items );
+    info->items = NULL;
+    info->count = 0;
+    info->alloc = 0;
+}
@@ -0,0 +1,49 @@
+/*
+    meta.h
+    Reading the metadata of a WAVE file as wavemetainfo style key/values
+
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _META_H
+#define _META_H
+
+typedef struct {
+    char key[32];           // eg 'info-iart' or 'disp-title'
+    char * value;           // Points into the arena
+} meta_item_t;
+
+typedef struct {
+    wave_format_t format;
+    uint32_t dataSeek;
+    uint32_t dataSize;
+    meta_item_t * items;
+    int count;
+    int alloc;
+    arena_t arena;          // Text of the current file, reused for the next
+} meta_info_t;
+
+
+void meta_init( meta_info_t* info );
+int meta_read( FILE* file, meta_info_t* info );
+void meta_load_text( FILE* file, meta_info_t* info );
+const char* meta_get( const meta_info_t* info, const char* key );
+void meta_free( meta_info_t* info );
+
+#endif //_META_H
@@ -0,0 +1,364 @@
+/*
+    mpeg.c
+    MPEG Audio frame parsing, frame indexing and Xing/Info headers
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "mpeg.h"
+
+
+#define XING_FLAGS          0x07    // Frames, Bytes and TOC fields present
+
+
+static const int bitrate_table[5][16] = {
+    { 0, 32, 64, 96,128,160,192,224,256,288,320,352,384,416,448, 0 }, // MPEG-1 Layer I
+    { 0, 32, 48, 56, 64, 80, 96,112,128,160,192,224,256,320,384, 0 }, // MPEG-1 Layer II
+    { 0, 32, 40, 48, 56, 64, 80, 96,112,128,160,192,224,256,320, 0 }, // MPEG-1 Layer III
+    { 0, 32, 48, 56, 64, 80, 96,112,128,144,160,176,192,224,256, 0 }, // MPEG-2 Layer I
+    { 0,  8, 16, 24, 32, 40, 48, 56, 64, 80, 96,112,128,144,160, 0 }  // MPEG-2 Layer II & III
+};
+
+static const int samplerate_table[3][3] = {
+    { 44100, 48000, 32000 },    // MPEG-1
+    { 22050, 24000, 16000 },    // MPEG-2
+    { 11025, 12000,  8000 }     // MPEG-2.5
+};
+
+
+static int
+frame_size( const mpeg_header_t* header, int bitrate, int padding )
+{
+    if (header->layer == 1)
+        return (12000 * bitrate / header->samplerate + padding) * 4;
+    else if (header->layer == 3 && header->version != 1)
+        return 72000 * bitrate / header->samplerate + padding;
+    else
+        return 144000 * bitrate / header->samplerate + padding;
+}
+
+
+static int
+bitrate_for_index( const mpeg_header_t* header, int index )
+{
+    if (header->version == 1)
+        return bitrate_table[ header->layer-1 ][ index ];
+    else
+        return bitrate_table[ header->layer == 1 ? 3 : 4 ][ index ];
+}
+
+
+// Size of the side information that comes before a Xing tag
+static int
+side_info_size( const mpeg_header_t* header )
+{
+    if (header->version == 1)
+        return header->mode == 3 ? 17 : 32;
+    else
+        return header->mode == 3 ? 9 : 17;
+}
+
+
+// Offset of a Xing/Info tag in a Layer III frame: after the
+// header, the CRC (if there is one) and the side information
+static int
+xing_offset( const mpeg_header_t* header )
+{
+    int crc = (header->raw[1] & 0x01) ? 0 : 2;
+    return 4 + crc + side_info_size( header );
+}
+
+
+
+// Parse a 4 byte frame header
+// Returns 0 on success or -1 if it isn't a valid header
+int
+mpeg_parse_header( const uint8_t* buf, mpeg_header_t* header )
+{
+    int version_bits = (buf[1] >> 3) & 0x03;
+    int layer_bits = (buf[1] >> 1) & 0x03;
+    int samplerate_index = (buf[2] >> 2) & 0x03;
+
+    if (buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0) return -1;
+    if (version_bits == 1 || layer_bits == 0) return -1;
+    if (samplerate_index == 3) return -1;
+
+    // Free format (0) and bad (15) bitrates aren't supported
+    header->bitrate_index = buf[2] >> 4;
+    if (header->bitrate_index == 0 || header->bitrate_index == 15) return -1;
+
+    memcpy( header->raw, buf, 4 );
+    header->version = version_bits == 3 ? 1 : (version_bits == 2 ? 2 : 25);
+    header->layer = 4 - layer_bits;
+    header->samplerate = samplerate_table[ version_bits == 3 ? 0 : (version_bits == 2 ? 1 : 2) ][ samplerate_index ];
+    header->bitrate = bitrate_for_index( header, header->bitrate_index );
+    header->padding = (buf[2] >> 1) & 0x01;
+    header->mode = buf[3] >> 6;
+    header->frame_size = frame_size( header, header->bitrate, header->padding );
+
+    if (header->layer == 1)
+        header->samples = 384;
+    else if (header->layer == 3 && header->version != 1)
+        header->samples = 576;
+    else
+        header->samples = 1152;
+
+    return 0;
+}
+
+
+// Find the first frame header in a buffer, which is followed
+// by another valid header (if the buffer is long enough)
+// Returns the offset of the header, or -1 if none was found
+int
+mpeg_find_header( const uint8_t* buf, size_t len, mpeg_header_t* header )
+{
+    size_t n;
+
+    for (n=0; n+4 <= len; n++) {
+        mpeg_header_t next;
+        size_t following;
+
+        if (mpeg_parse_header( buf+n, header )) continue;
+
+        following = n + header->frame_size;
+        if (following+4 > len) return n;
+        if (mpeg_parse_header( buf+following, &next ) == 0 &&
+            next.version == header->version && next.layer == header->layer)
+            return n;
+    }
+
+    return -1;
+}
+
+
+// Check if a frame already contains a Xing, Info or VBRI header
+// (these are only used in Layer III streams)
+int
+mpeg_has_vbr_header( const uint8_t* frame, size_t len, const mpeg_header_t* header )
+{
+    size_t offset = xing_offset( header );
+
+    if (header->layer != 3) return 0;
+    if (offset+4 <= len &&
+        (memcmp( frame+offset, "Xing", 4 )==0 || memcmp( frame+offset, "Info", 4 )==0))
+        return 1;
+    if (36+4 <= len && memcmp( frame+36, "VBRI", 4 )==0)
+        return 1;
+
+    return 0;
+}
+
+
+
+void
+mpeg_index_init( mpeg_index_t* index )
+{
+    memset( index, 0, sizeof(mpeg_index_t) );
+}
+
+
+static void
+index_add( mpeg_index_t* index, uint32_t offset )
+{
+    if (index->frames == index->alloc) {
+        index->alloc = index->alloc ? index->alloc*2 : 4096;
+        index->offsets = realloc( index->offsets, index->alloc * sizeof(uint32_t) );
+        if (!index->offsets) handle_error("unable to allocate memory for frame index");
+    }
+    index->offsets[ index->frames++ ] = offset;
+}
+
+
+// Add the next buffer of the payload to the index
+// Only the frame headers are looked at, so this is cheap
+// enough to run inline with a copy.
+void
+mpeg_index_feed( void* arg, const uint8_t* data, size_t len )
+{
+    mpeg_index_t* index = arg;
+    uint64_t start = index->pos;
+    uint64_t end = start + len;
+    uint8_t tail[3];
+    int n;
+
+    while (index->next + 4 <= end) {
+        uint8_t buf[4];
+        mpeg_header_t header;
+
+        // The header may start in the previous buffer
+        for (n=0; n<4; n++) {
+            uint64_t p = index->next + n;
+            buf[n] = p < start ? index->tail[ p - (start-3) ] : data[ p - start ];
+        }
+
+        if (mpeg_parse_header( buf, &header ) == 0 &&
+            (index->frames == 0 ||
+             (header.version == index->first.version &&
+              header.layer == index->first.layer &&
+              header.samplerate == index->first.samplerate))) {
+            if (index->frames == 0) index->first = header;
+            else if (header.bitrate != index->first.bitrate) index->vbr = 1;
+            if (header.padding) index->padded++;
+            index_add( index, index->next );
+            index->next += header.frame_size;
+        } else {
+            // Lost sync; step forward a byte at a time
+            if (index->frames) index->resyncs++;
+            index->next++;
+        }
+    }
+
+    // Remember the last few bytes, for a header split across buffers
+    for (n=0; n<3; n++) {
+        uint64_t p = end - 3 + n;
+        if (end < 3 - n) tail[n] = 0;
+        else if (p < start) tail[n] = index->tail[ p - (start-3) ];
+        else tail[n] = data[ p - start ];
+    }
+    memcpy( index->tail, tail, sizeof(tail) );
+
+    index->pos = end;
+}
+
+
+void
+mpeg_index_free( mpeg_index_t* index )
+{
+    free( index->offsets );
+    index->offsets = NULL;
+    index->frames = 0;
+    index->alloc = 0;
+}
+
+
+
+// Work out the header for a Xing/Info frame that matches the
+// first frame of the stream and is large enough for the tag.
+// Returns the size of the frame, or 0 if there isn't a suitable one
+// (players only look for the tag in Layer III streams)
+int
+mpeg_xing_size( const mpeg_header_t* first, mpeg_header_t* xing )
+{
+    int needed = 4 + side_info_size( first ) + 4 + 4 + 4 + 4 + MPEG_TOC_ENTRIES;
+    int index;
+
+    if (first->layer != 3) return 0;
+
+    for (index = first->bitrate_index; index < 15; index++) {
+        int bitrate = bitrate_for_index( first, index );
+        int size = frame_size( first, bitrate, 0 );
+        if (size >= needed) {
+            *xing = *first;
+            xing->bitrate_index = index;
+            xing->bitrate = bitrate;
+            xing->padding = 0;
+            xing->frame_size = size;
+            xing->raw[1] |= 0x01;       // No CRC
+            xing->raw[2] = (index << 4) | (first->raw[2] & 0x0D);
+            return size;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+put_uint32_be( uint8_t* p, uint32_t x )
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+
+// Fill in a Xing/Info frame of xing->frame_size bytes
+// using the frame index of the payload that follows it
+void
+mpeg_xing_build( const mpeg_index_t* index, const mpeg_header_t* xing, uint8_t* frame )
+{
+    uint8_t * p = frame + xing_offset( xing );
+    uint64_t total = xing->frame_size + index->pos;
+    int n;
+
+    memset( frame, 0, xing->frame_size );
+    memcpy( frame, xing->raw, 4 );
+
+    memcpy( p, index->vbr ? "Xing" : "Info", 4 );
+    put_uint32_be( p+4, XING_FLAGS );
+    put_uint32_be( p+8, index->frames );
+    put_uint32_be( p+12, total );
+
+    // Byte position (out of 256) of each percent of the duration
+    for (n=0; n<MPEG_TOC_ENTRIES; n++) {
+        uint64_t offset;
+        if (index->frames) {
+            uint32_t frame_num = (uint64_t)n * index->frames / MPEG_TOC_ENTRIES;
+            offset = (xing->frame_size + index->offsets[ frame_num ]) * 256 / total;
+        } else {
+            offset = n * 256 / MPEG_TOC_ENTRIES;
+        }
+        p[16+n] = offset > 255 ? 255 : offset;
+    }
+}
+
+
+// Write a sidecar seek index, giving the offset within the WAVE
+// file of the frame at the start of every second of audio
+int
+mpeg_write_seek_index( const mpeg_index_t* index, uint32_t dataSeek, const char* filename )
+{
+    const mpeg_header_t* first = &index->first;
+    FILE* file = fopen( filename, "w" );
+    uint64_t second = 0;
+    uint32_t n;
+
+    if (file == NULL) return -1;
+
+    fprintf(file, "mpeg-version: %s\n", first->version == 25 ? "2.5" : (first->version == 2 ? "2" : "1"));
+    fprintf(file, "mpeg-layer: %d\n", first->layer);
+    fprintf(file, "mpeg-sample-rate: %d\n", first->samplerate);
+    fprintf(file, "mpeg-samples-per-frame: %d\n", first->samples);
+    fprintf(file, "mpeg-vbr: %s\n", index->vbr ? "yes" : "no");
+    fprintf(file, "mpeg-frames: %u\n", index->frames);
+    fprintf(file, "data-seek: 0x%6.6x\n", dataSeek);
+    fprintf(file, "data-size: 0x%6.6llx\n", (unsigned long long)index->pos);
+    fprintf(file, "\n");
+
+    // One line per second: <milliseconds> <offset in wave file>
+    for (n=0; n<index->frames; n++) {
+        uint64_t sample = (uint64_t)n * first->samples;
+        if (sample >= second * first->samplerate) {
+            fprintf(file, "%llu %llu\n", (unsigned long long)(sample * 1000 / first->samplerate),
+                    (unsigned long long)dataSeek + index->offsets[n]);
+            second = sample / first->samplerate + 1;
+        }
+    }
+
+    return fclose( file );
+}
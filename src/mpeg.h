@@ -0,0 +1,69 @@
+/*
+    mpeg.h
+    MPEG Audio frame parsing, frame indexing and Xing/Info headers
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _MPEG_H
+#define _MPEG_H
+
+#define MPEG_TOC_ENTRIES    100
+
+
+typedef struct {
+    uint8_t raw[4];         // The header as it appeared in the stream
+    int version;            // 1 = MPEG-1, 2 = MPEG-2, 25 = MPEG-2.5
+    int layer;              // 1, 2 or 3
+    int bitrate;            // kbps
+    int bitrate_index;
+    int samplerate;         // Hz
+    int padding;
+    int mode;               // 3 = mono
+    int frame_size;         // bytes, including the header
+    int samples;            // samples per frame
+} mpeg_header_t;
+
+
+typedef struct {
+    mpeg_header_t first;    // Header of the first frame found
+    uint32_t * offsets;     // Payload offset of every frame
+    uint32_t frames;
+    uint32_t alloc;
+    uint64_t next;          // Payload offset of the next expected frame
+    uint64_t pos;           // Payload offset of the next byte to be fed
+    uint8_t tail[3];        // Last bytes of the previous buffer
+    int vbr;
+    uint32_t padded;        // Number of frames with the padding bit set
+    uint32_t resyncs;
+} mpeg_index_t;
+
+
+int mpeg_parse_header( const uint8_t* buf, mpeg_header_t* header );
+int mpeg_find_header( const uint8_t* buf, size_t len, mpeg_header_t* header );
+int mpeg_has_vbr_header( const uint8_t* frame, size_t len, const mpeg_header_t* header );
+
+void mpeg_index_init( mpeg_index_t* index );
+void mpeg_index_feed( void* index, const uint8_t* data, size_t len );
+void mpeg_index_free( mpeg_index_t* index );
+
+int mpeg_xing_size( const mpeg_header_t* first, mpeg_header_t* xing );
+void mpeg_xing_build( const mpeg_index_t* index, const mpeg_header_t* xing, uint8_t* frame );
+int mpeg_write_seek_index( const mpeg_index_t* index, uint32_t dataSeek, const char* filename );
+
+#endif //_MPEG_H
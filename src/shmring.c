@@ -0,0 +1,342 @@
+/*
+    shmring.c
+    Single producer, single consumer ring buffer in POSIX shared memory
+
+    Lets a player start on the audio while waveunwrap is still copying
+    it. The writer publishes the format in the header, then streams the
+    data chunk through the ring. Neither side takes a lock: the writer
+    only moves 'head' and the reader only moves 'tail', with release
+    stores and acquire loads so that the bytes between them are visible
+    before the counters are. A full (or empty) ring is waited on by
+    spinning briefly and then sleeping for short periods, which keeps
+    the latency well under a millisecond without a busy loop.
+
+    The writer creates the shared memory; the reader removes its name
+    once it has it mapped. Each side records its pid, so that the other
+    can tell if it was killed without cleaning up.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "shmring.h"
+
+
+#define SPIN_COUNT      100
+#define YIELD_COUNT     200
+#define SLEEP_NS        50000           // 50 us
+#define CHECK_INTERVAL  0.1             // How often to check on the other side, in seconds
+
+
+// Wait a little, backing off the longer we have been waiting
+static void
+backoff( int* tries )
+{
+    struct timespec ts = { 0, SLEEP_NS };
+
+    if (*tries < SPIN_COUNT) {
+        // Just try again
+    } else if (*tries < YIELD_COUNT) {
+        sched_yield();
+    } else {
+        nanosleep( &ts, NULL );
+    }
+    (*tries)++;
+}
+
+
+static size_t
+round_up_pow2( size_t x )
+{
+    size_t size = 4096;
+    while (size < x) size <<= 1;
+    return size;
+}
+
+
+// Create the shared memory and publish the format of the audio,
+// along with the source's own fmt and fact chunks (factSamples may be NULL)
+shmring_t*
+shmring_create( const char* name, size_t capacity, const wave_format_t* fmt,
+                const uint8_t* fmtChunk, uint32_t fmtSize, const uint32_t* factSamples,
+                uint64_t dataSize, int idleTimeout )
+{
+    shmring_t * ring = calloc( 1, sizeof(shmring_t) );
+    shmring_header_t * header;
+    void * map;
+    int fd;
+
+    if (!ring) handle_error( "Unable to allocate memory for ring buffer." );
+
+    capacity = round_up_pow2( capacity );
+    ring->mapSize = SHMRING_HEADER_SIZE + capacity;
+    ring->mask = capacity - 1;
+    ring->idleTimeout = idleTimeout;
+
+    // Replace anything left behind by an earlier run
+    shm_unlink( name );
+    fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+    if (fd < 0) handle_error( "Unable to create shared memory." );
+    if (ftruncate( fd, ring->mapSize ))
+        handle_error( "Unable to size shared memory." );
+    map = mmap( NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if (map == MAP_FAILED) handle_error( "Unable to map shared memory." );
+    close( fd );
+
+    ring->header = header = map;
+    ring->ring = (uint8_t*)map + SHMRING_HEADER_SIZE;
+
+    header->magic = SHMRING_MAGIC;
+    header->version = SHMRING_VERSION;
+    header->capacity = capacity;
+    header->dataSize = dataSize;
+    header->format = *fmt;
+    header->fmtSize = fmtSize <= SHMRING_FMT_SIZE ? fmtSize : 0;
+    memcpy( header->fmtChunk, fmtChunk, header->fmtSize );
+    header->hasFact = (factSamples != NULL);
+    header->factSamples = factSamples ? *factSamples : 0;
+    atomic_init( &header->state, SHMRING_STREAMING );
+    atomic_init( &header->reader, SHMRING_NO_READER );
+    atomic_init( &header->readerPid, 0 );
+    atomic_init( &header->writerPid, getpid() );
+    atomic_init( &header->head, 0 );
+    atomic_init( &header->tail, 0 );
+    atomic_store_explicit( &header->ready, 1, memory_order_release );
+
+    return ring;
+}
+
+
+// Check whether a process has died
+static int
+process_gone( atomic_int* pidp )
+{
+    int pid = atomic_load_explicit( pidp, memory_order_relaxed );
+    return pid > 0 && kill( pid, 0 ) < 0 && errno == ESRCH;
+}
+
+
+// Check whether the reader has gone away, closing the ring or not
+static int
+reader_gone( shmring_header_t* header )
+{
+    if (atomic_load_explicit( &header->reader, memory_order_acquire ) == SHMRING_CLOSED)
+        return 1;
+    return process_gone( &header->readerPid );
+}
+
+
+// Copy engine sink: add data to the ring, waiting while it is full
+void
+shmring_feed( void* arg, const uint8_t* data, size_t len )
+{
+    shmring_t * ring = arg;
+    shmring_header_t * header = ring->header;
+    uint64_t capacity = header->capacity;
+    uint64_t head = atomic_load_explicit( &header->head, memory_order_relaxed );
+    double waitStart = 0, lastCheck = 0;
+    int tries = 0;
+
+    while (len) {
+        uint64_t tail = atomic_load_explicit( &header->tail, memory_order_acquire );
+        size_t space = capacity - (head - tail);
+        size_t offset = head & ring->mask;
+        size_t n, first;
+
+        if (space == 0) {
+            double t = now();
+            if (tries == 0) waitStart = lastCheck = t;
+            if (t - lastCheck > CHECK_INTERVAL) {
+                if (reader_gone( header )) handle_error( "The reader closed the ring buffer." );
+                lastCheck = t;
+            }
+            if (ring->idleTimeout && t - waitStart > ring->idleTimeout)
+                handle_error( "Timed out waiting for the reader." );
+
+            // Don't wait for ever for a reader that never turns up
+            if (!ring->idleTimeout && t - waitStart > SHMRING_ATTACH_TIMEOUT &&
+                atomic_load_explicit( &header->reader, memory_order_acquire ) == SHMRING_NO_READER)
+                handle_error( "No reader opened the ring buffer." );
+            backoff( &tries );
+            continue;
+        }
+        tries = 0;
+
+        // Copy in up to two pieces, either side of the end of the ring
+        n = len < space ? len : space;
+        first = capacity - offset < n ? capacity - offset : n;
+        memcpy( ring->ring + offset, data, first );
+        memcpy( ring->ring, data + first, n - first );
+
+        head += n;
+        atomic_store_explicit( &header->head, head, memory_order_release );
+        data += n;
+        len -= n;
+    }
+}
+
+
+// Tell the reader that there is no more to come
+void
+shmring_finish( shmring_t* ring, int state )
+{
+    atomic_store_explicit( &ring->header->state, state, memory_order_release );
+    munmap( ring->header, ring->mapSize );
+    free( ring );
+}
+
+
+// Tell the reader that the writer has failed, leaving the ring mapped
+// Safe to call from a signal handler, or while another thread is feeding it
+void
+shmring_abort( shmring_t* ring )
+{
+    atomic_store_explicit( &ring->header->state, SHMRING_ABORTED, memory_order_release );
+}
+
+
+
+// Open a ring, waiting up to timeout seconds for the writer to create it
+// Returns NULL if it doesn't appear
+shmring_t*
+shmring_attach( const char* name, int timeout )
+{
+    shmring_t * ring = calloc( 1, sizeof(shmring_t) );
+    shmring_header_t * header;
+    double start = now();
+    struct stat st;
+    int tries = 0;
+    void * map;
+    int fd;
+
+    if (!ring) handle_error( "Unable to allocate memory for ring buffer." );
+
+    // Wait for the writer to create and size it, then publish the format
+    for (;;) {
+        fd = shm_open( name, O_RDWR, 0 );
+        if (fd >= 0 && fstat( fd, &st )==0 && st.st_size > SHMRING_HEADER_SIZE) {
+            map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+            if (map == MAP_FAILED) handle_error( "Unable to map shared memory." );
+            header = map;
+            while (!atomic_load_explicit( &header->ready, memory_order_acquire )) {
+                if (timeout && now() - start > timeout) break;
+                backoff( &tries );
+            }
+            if (atomic_load_explicit( &header->ready, memory_order_acquire )) break;
+            munmap( map, st.st_size );
+        }
+        if (fd >= 0) close( fd );
+        if (timeout && now() - start > timeout) {
+            free( ring );
+            return NULL;
+        }
+        backoff( &tries );
+    }
+    close( fd );
+
+    if (header->magic != SHMRING_MAGIC || header->version != SHMRING_VERSION ||
+        SHMRING_HEADER_SIZE + header->capacity != st.st_size) {
+        fprintf(stderr, "Error: '%s' isn't a waveunwrap ring buffer.\n", name);
+        exit(2);
+    }
+
+    // Nobody else can attach now; the memory stays until both sides unmap it
+    shm_unlink( name );
+    atomic_store_explicit( &header->readerPid, getpid(), memory_order_relaxed );
+    atomic_store_explicit( &header->reader, SHMRING_READING, memory_order_release );
+
+    ring->header = header;
+    ring->ring = (uint8_t*)map + SHMRING_HEADER_SIZE;
+    ring->mapSize = st.st_size;
+    ring->mask = header->capacity - 1;
+    return ring;
+}
+
+
+// Read up to len bytes, waiting until there are some
+// Returns the number of bytes read, 0 at the end, or -1 if the writer failed
+ssize_t
+shmring_read( shmring_t* ring, uint8_t* buf, size_t len )
+{
+    shmring_header_t * header = ring->header;
+    uint64_t capacity = header->capacity;
+    uint64_t tail = atomic_load_explicit( &header->tail, memory_order_relaxed );
+    uint64_t head;
+    size_t offset = tail & ring->mask;
+    size_t n, first;
+    double lastCheck = 0;
+    int writerGone = 0;
+    int tries = 0;
+
+    // The state is set after the last of the data, so if it says
+    // the stream has ended, head is final when it is loaded after it
+    for (;;) {
+        unsigned int state = atomic_load_explicit( &header->state, memory_order_acquire );
+        head = atomic_load_explicit( &header->head, memory_order_acquire );
+        if (head != tail) break;
+        if (state == SHMRING_END) return 0;
+        if (state != SHMRING_STREAMING || writerGone) return -1;
+
+        // A writer that was killed can't say so; look once more
+        // after finding it gone, in case it finished just before
+        if (tries >= YIELD_COUNT) {
+            double t = now();
+            if (lastCheck == 0) lastCheck = t;
+            if (t - lastCheck > CHECK_INTERVAL) {
+                writerGone = process_gone( &header->writerPid );
+                lastCheck = t;
+                if (writerGone) continue;
+            }
+        }
+        backoff( &tries );
+    }
+
+    n = head - tail < len ? head - tail : len;
+    first = capacity - offset < n ? capacity - offset : n;
+    memcpy( buf, ring->ring + offset, first );
+    memcpy( buf + first, ring->ring, n - first );
+
+    atomic_store_explicit( &header->tail, tail + n, memory_order_release );
+    return n;
+}
+
+
+// Let the writer know that nothing more will be read
+void
+shmring_close( shmring_t* ring )
+{
+    atomic_store_explicit( &ring->header->reader, SHMRING_CLOSED, memory_order_release );
+    munmap( ring->header, ring->mapSize );
+    free( ring );
+}
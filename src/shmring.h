@@ -0,0 +1,88 @@
+/*
+    shmring.h
+    Single producer, single consumer ring buffer in POSIX shared memory
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#define SHMRING_MAGIC       0x474e5257      // 'WRNG'
+#define SHMRING_VERSION     3
+#define SHMRING_HEADER_SIZE 4096            // The ring starts on the next page
+#define SHMRING_FIRST_BLOCK (16*1024)       // Sent on its own, to start playback sooner
+#define SHMRING_FMT_SIZE    256             // Largest 'fmt ' chunk passed on
+#define SHMRING_ATTACH_TIMEOUT 30          // Seconds to wait for a reader, without -t
+
+// Stream states
+#define SHMRING_STREAMING   0
+#define SHMRING_END         1               // Everything has been written
+#define SHMRING_ABORTED     2               // The writer failed part way
+
+// Reader states
+#define SHMRING_NO_READER   0
+#define SHMRING_READING     1
+#define SHMRING_CLOSED      2               // The reader has gone away
+
+
+// At the start of the shared memory; the fields before 'ready' are
+// written once, before 'ready' is set
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;              // Size of the ring; a power of two
+    uint64_t dataSize;              // Size of the data chunk being streamed
+    wave_format_t format;
+    uint32_t fmtSize;               // The source's 'fmt ' chunk, or 0 if too big
+    uint8_t fmtChunk[SHMRING_FMT_SIZE];
+    uint32_t hasFact;               // And its 'fact' sample count, if it had one
+    uint32_t factSamples;
+    atomic_uint ready;
+    atomic_uint state;
+    atomic_uint reader;
+    atomic_int readerPid;           // So each side can tell if the other has died
+    atomic_int writerPid;
+
+    // Bytes written and read in total; each on its own cache line
+    _Alignas(64) atomic_uint_fast64_t head;
+    _Alignas(64) atomic_uint_fast64_t tail;
+} shmring_header_t;
+
+
+typedef struct {
+    shmring_header_t * header;
+    uint8_t * ring;
+    size_t mapSize;
+    uint64_t mask;
+    int idleTimeout;                // Seconds, or 0 to wait for ever
+} shmring_t;
+
+
+shmring_t* shmring_create( const char* name, size_t capacity, const wave_format_t* fmt,
+                           const uint8_t* fmtChunk, uint32_t fmtSize, const uint32_t* factSamples,
+                           uint64_t dataSize, int idleTimeout );
+void shmring_feed( void* ring, const uint8_t* data, size_t len );
+void shmring_finish( shmring_t* ring, int state );
+void shmring_abort( shmring_t* ring );
+
+shmring_t* shmring_attach( const char* name, int timeout );
+ssize_t shmring_read( shmring_t* ring, uint8_t* buf, size_t len );
+void shmring_close( shmring_t* ring );
+
+#endif //_SHMRING_H
@@ -0,0 +1,321 @@
+/*
+    split.c
+    Splitting interleaved PCM into one mono file per channel
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "split.h"
+
+
+#ifdef __SSE2__
+
+// 16-bit samples, 8 channels at a time: transpose 8x8 blocks
+static size_t
+deinterleave16_sse2( const uint8_t* in, uint8_t** out, int channels, size_t frames )
+{
+    size_t f;
+    int g, k;
+
+    for (f=0; f+8 <= frames; f+=8) {
+        for (g=0; g<channels; g+=8) {
+            const uint8_t* src = in + (f*channels + g)*2;
+            size_t stride = channels*2;
+            __m128i r[8], a[8], b[8];
+
+            for (k=0; k<8; k++)
+                r[k] = _mm_loadu_si128( (const __m128i*)(src + k*stride) );
+
+            for (k=0; k<8; k+=2) {
+                a[k/2] = _mm_unpacklo_epi16( r[k], r[k+1] );
+                a[k/2+4] = _mm_unpackhi_epi16( r[k], r[k+1] );
+            }
+
+            b[0] = _mm_unpacklo_epi32( a[0], a[1] );
+            b[1] = _mm_unpackhi_epi32( a[0], a[1] );
+            b[2] = _mm_unpacklo_epi32( a[4], a[5] );
+            b[3] = _mm_unpackhi_epi32( a[4], a[5] );
+            b[4] = _mm_unpacklo_epi32( a[2], a[3] );
+            b[5] = _mm_unpackhi_epi32( a[2], a[3] );
+            b[6] = _mm_unpacklo_epi32( a[6], a[7] );
+            b[7] = _mm_unpackhi_epi32( a[6], a[7] );
+
+            for (k=0; k<4; k++) {
+                _mm_storeu_si128( (__m128i*)(out[g+2*k] + f*2), _mm_unpacklo_epi64( b[k], b[k+4] ) );
+                _mm_storeu_si128( (__m128i*)(out[g+2*k+1] + f*2), _mm_unpackhi_epi64( b[k], b[k+4] ) );
+            }
+        }
+    }
+
+    return f;
+}
+
+
+// 32-bit integer or float samples, 4 channels at a time: transpose 4x4 blocks
+static size_t
+deinterleave32_sse2( const uint8_t* in, uint8_t** out, int channels, size_t frames )
+{
+    size_t f;
+    int g;
+
+    for (f=0; f+4 <= frames; f+=4) {
+        for (g=0; g<channels; g+=4) {
+            const uint8_t* src = in + (f*channels + g)*4;
+            size_t stride = channels*4;
+            __m128i r0 = _mm_loadu_si128( (const __m128i*)(src) );
+            __m128i r1 = _mm_loadu_si128( (const __m128i*)(src + stride) );
+            __m128i r2 = _mm_loadu_si128( (const __m128i*)(src + 2*stride) );
+            __m128i r3 = _mm_loadu_si128( (const __m128i*)(src + 3*stride) );
+            __m128i a0 = _mm_unpacklo_epi32( r0, r1 );
+            __m128i a1 = _mm_unpackhi_epi32( r0, r1 );
+            __m128i a2 = _mm_unpacklo_epi32( r2, r3 );
+            __m128i a3 = _mm_unpackhi_epi32( r2, r3 );
+
+            _mm_storeu_si128( (__m128i*)(out[g] + f*4), _mm_unpacklo_epi64( a0, a2 ) );
+            _mm_storeu_si128( (__m128i*)(out[g+1] + f*4), _mm_unpackhi_epi64( a0, a2 ) );
+            _mm_storeu_si128( (__m128i*)(out[g+2] + f*4), _mm_unpacklo_epi64( a1, a3 ) );
+            _mm_storeu_si128( (__m128i*)(out[g+3] + f*4), _mm_unpackhi_epi64( a1, a3 ) );
+        }
+    }
+
+    return f;
+}
+
+#endif
+
+
+// Copy each channel of frames of interleaved samples into its own buffer
+void
+deinterleave( const uint8_t* in, uint8_t** out, int channels, int width, size_t frames )
+{
+    size_t f = 0;
+    int c;
+
+#ifdef __SSE2__
+    if (width == 2 && channels % 8 == 0)
+        f = deinterleave16_sse2( in, out, channels, frames );
+    else if (width == 4 && channels % 4 == 0)
+        f = deinterleave32_sse2( in, out, channels, frames );
+#endif
+
+    // Whatever is left over is done a sample at a time
+    in += f * channels * width;
+    switch (width) {
+        case 2:
+            for (; f<frames; f++)
+                for (c=0; c<channels; c++, in+=2)
+                    memcpy( out[c] + f*2, in, 2 );
+        break;
+        case 3:
+            for (; f<frames; f++)
+                for (c=0; c<channels; c++, in+=3) {
+                    uint8_t* o = out[c] + f*3;
+                    o[0] = in[0]; o[1] = in[1]; o[2] = in[2];
+                }
+        break;
+        case 4:
+            for (; f<frames; f++)
+                for (c=0; c<channels; c++, in+=4)
+                    memcpy( out[c] + f*4, in, 4 );
+        break;
+        default:
+            for (; f<frames; f++)
+                for (c=0; c<channels; c++, in+=width)
+                    memcpy( out[c] + f*width, in, width );
+        break;
+    }
+}
+
+
+
+static char*
+split_filename( const char* outputname, int channel, int channels, int raw )
+{
+    size_t len = strlen( outputname );
+    char * filename = malloc( len + 16 );
+
+    if (!filename) handle_error( "Unable to allocate memory for filename." );
+
+    // Drop the suffix, so that 'show.wav' becomes 'show-01.wav' etc
+    if (len > 4 && (strcasecmp( outputname+len-4, ".wav" )==0 ||
+                    strcasecmp( outputname+len-4, ".raw" )==0))
+        len -= 4;
+
+    sprintf( filename, "%.*s-%0*d.%s", (int)len, outputname,
+             channels >= 10 ? 2 : 1, channel+1, raw ? "raw" : "wav" );
+
+    return filename;
+}
+
+
+static void
+split_flush( split_t* split )
+{
+    int c;
+
+    for (c=0; c<split->channels; c++)
+        write_bytes( split->fds[c], split->buffers[c], split->fill );
+
+    split->fill = 0;
+}
+
+
+// Open one output per channel and write their headers
+void
+split_open( split_t* split, const char* outputname, const wave_format_t* fmt,
+            uint32_t dataSize, int raw, int metaFd, const wave_chunk_t* meta, int metaCount )
+{
+    wave_format_t mono = *fmt;
+    int c;
+
+    memset( split, 0, sizeof(split_t) );
+    split->channels = fmt->channels;
+    split->width = fmt->blockAlign / fmt->channels;
+    split->raw = raw;
+    split->dataSize = (dataSize / fmt->blockAlign) * split->width;
+    split->capacity = (SPLIT_BUFFER_SIZE / split->width) * split->width;
+
+    mono.audioFormat = wave_sample_format( fmt );
+    mono.channels = 1;
+    mono.blockAlign = split->width;
+    mono.byteRate = fmt->sampleRate * split->width;
+
+    split->fds = calloc( split->channels, sizeof(int) );
+    split->buffers = calloc( split->channels, sizeof(uint8_t*) );
+    split->outptrs = calloc( split->channels, sizeof(uint8_t*) );
+    split->partial = malloc( fmt->blockAlign );
+    if (!split->fds || !split->buffers || !split->outptrs || !split->partial)
+        handle_error( "Unable to allocate memory for channel buffers." );
+
+    for (c=0; c<split->channels; c++) {
+        char * filename = split_filename( outputname, c, split->channels, raw );
+
+        split->fds[c] = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+        if (split->fds[c] < 0) handle_error( "unable to open output file" );
+        free( filename );
+
+        split->buffers[c] = malloc( split->capacity );
+        if (!split->buffers[c])
+            handle_error( "Unable to allocate memory for channel buffers." );
+
+        if (!raw)
+            wave_write_header( split->fds[c], &mono, split->dataSize, metaFd, meta, metaCount );
+
+#ifdef HAVE_FALLOCATE
+        fallocate( split->fds[c], 0, lseek( split->fds[c], 0, SEEK_CUR ), split->dataSize );
+#endif
+    }
+}
+
+
+static void
+split_frames( split_t* split, const uint8_t* in, size_t frames )
+{
+    size_t frameSize = split->channels * split->width;
+    int c;
+
+    while (frames) {
+        size_t n = (split->capacity - split->fill) / split->width;
+        if (n > frames) n = frames;
+
+        for (c=0; c<split->channels; c++)
+            split->outptrs[c] = split->buffers[c] + split->fill;
+        deinterleave( in, split->outptrs, split->channels, split->width, n );
+
+        split->fill += n * split->width;
+        in += n * frameSize;
+        frames -= n;
+
+        if (split->fill == split->capacity) split_flush( split );
+    }
+}
+
+
+// Copy engine sink: de-interleave the next block of the data chunk
+void
+split_feed( void* arg, const uint8_t* data, size_t len )
+{
+    split_t* split = arg;
+    size_t frameSize = split->channels * split->width;
+    size_t frames;
+
+    // Complete a frame left over from the previous block
+    if (split->partialLen) {
+        size_t take = frameSize - split->partialLen;
+        if (take > len) take = len;
+        memcpy( split->partial + split->partialLen, data, take );
+        split->partialLen += take;
+        data += take;
+        len -= take;
+
+        if (split->partialLen < frameSize) return;
+        split_frames( split, split->partial, 1 );
+        split->partialLen = 0;
+    }
+
+    frames = len / frameSize;
+    split_frames( split, data, frames );
+
+    split->partialLen = len - frames * frameSize;
+    memcpy( split->partial, data + frames * frameSize, split->partialLen );
+}
+
+
+void
+split_close( split_t* split )
+{
+    int c;
+
+    split_flush( split );
+
+    for (c=0; c<split->channels; c++) {
+        // Chunks are padded to an even length
+        if (!split->raw && (split->dataSize & 1)) {
+            if (write( split->fds[c], "", 1 )!=1)
+                handle_error( "Unable to write bytes to output file." );
+        }
+        if (close( split->fds[c] ))
+            handle_error( "unable to close output file" );
+        free( split->buffers[c] );
+    }
+
+    free( split->fds );
+    free( split->buffers );
+    free( split->outptrs );
+    free( split->partial );
+}
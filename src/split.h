@@ -0,0 +1,51 @@
+/*
+    split.h
+    Splitting interleaved PCM into one mono file per channel
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _SPLIT_H
+#define _SPLIT_H
+
+#define SPLIT_BUFFER_SIZE   (256*1024)
+
+
+typedef struct {
+    int channels;
+    int width;              // Bytes per sample
+    int raw;                // Headerless outputs, without a pad byte
+    int * fds;
+    uint8_t ** buffers;     // Output buffer for each channel
+    uint8_t ** outptrs;
+    size_t fill;            // Bytes in each of the output buffers
+    size_t capacity;
+    uint8_t * partial;      // Frame split across two input blocks
+    size_t partialLen;
+    uint32_t dataSize;      // Bytes written to each output
+} split_t;
+
+
+void deinterleave( const uint8_t* in, uint8_t** out, int channels, int width, size_t frames );
+
+void split_open( split_t* split, const char* outputname, const wave_format_t* fmt,
+                 uint32_t dataSize, int raw, int metaFd, const wave_chunk_t* meta, int metaCount );
+void split_feed( void* split, const uint8_t* data, size_t len );
+void split_close( split_t* split );
+
+#endif //_SPLIT_H
@@ -20,9 +20,12 @@
 
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -132,3 +135,80 @@ write_uint8( FILE* file, uint8_t x, const char * err_str )
     }
 }
 
+
+// Write all of a buffer to a file descriptor, retrying short writes
+void
+write_bytes( int fd, const void* data, size_t len )
+{
+    const uint8_t* p = data;
+
+    while (len) {
+        ssize_t res = write( fd, p, len );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) handle_error( "Unable to write bytes to output file." );
+        p += res;
+        len -= res;
+    }
+}
+
+
+// The current time, in seconds
+double
+now( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+// Walk the sub chunks of a RIFF/WAVE file looking for the 'data' chunk.
+// Unlike the readers above, this doesn't exit on failure, so that
+// it can be used when scanning many files.
+// Returns 0 and sets dataSeek/dataSize if found, or -1 otherwise
+int
+find_data_chunk( FILE* file, uint32_t* dataSeek, uint32_t* dataSize )
+{
+    char header[12];
+    uint32_t chunkSize;
+    uint32_t nextChunk;
+    uint32_t seek = 12;
+
+    if (fseek(file, 0, SEEK_SET)!=0) return -1;
+    if (fread(header, sizeof(header), 1, file)!=1) return -1;
+    if (memcmp("RIFF", header, 4)!=0 || memcmp("WAVE", header+8, 4)!=0) return -1;
+
+    memcpy(&chunkSize, header+4, sizeof(chunkSize));
+#ifdef WORDS_BIGENDIAN
+    chunkSize = my_swap32( chunkSize );
+#endif
+    nextChunk = 8+chunkSize;
+
+    while (seek < nextChunk) {
+        char type[4];
+        uint32_t subSize;
+
+        // Skip the odd NULL bytes found after some chunks
+        do {
+            if (fseek(file, seek, SEEK_SET)!=0) return -1;
+            if (fread(&type, sizeof(type), 1, file)!=1) return -1;
+            if (type[0] == 0) ++seek;
+        } while (type[0] == 0);
+
+        if (fread(&subSize, sizeof(subSize), 1, file)!=1) return -1;
+#ifdef WORDS_BIGENDIAN
+        subSize = my_swap32( subSize );
+#endif
+
+        if (memcmp("data", &type, sizeof(type))==0) {
+            *dataSeek = seek+8;
+            *dataSize = subSize;
+            return 0;
+        }
+
+        if (seek+8+subSize < seek) return -1;
+        seek += 8+subSize;
+    }
+
+    return -1;
+}
@@ -35,4 +35,10 @@ void write_uint32( FILE* file, uint32_t x, const char * err_str );
 void write_uint16( FILE* file, uint16_t x, const char * err_str );
 void write_uint8( FILE* file, uint8_t x, const char * err_str );
 
+void write_bytes( int fd, const void* data, size_t len );
+
+double now( void );
+
+int find_data_chunk( FILE* file, uint32_t* dataSeek, uint32_t* dataSize );
+
 #endif //_UTIL_H
@@ -0,0 +1,153 @@
+/*
+    wave.c
+    Writing RIFF/WAVE headers for the files produced by the tools
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+
+
+// Read the fields of a 'fmt ' chunk
+void
+wave_read_format( FILE* file, uint32_t chunkSize, wave_format_t* fmt )
+{
+    memset( fmt, 0, sizeof(wave_format_t) );
+
+    fmt->audioFormat = read_uint16( file, "fmt-audio-format" );
+    fmt->channels = read_uint16( file, "fmt-num-channels" );
+    fmt->sampleRate = read_uint32( file, "fmt-sample-rate" );
+    fmt->byteRate = read_uint32( file, "fmt-byte-rate" );
+    fmt->blockAlign = read_uint16( file, "fmt-block-align" );
+    if (chunkSize >= 16)
+        fmt->sampleSize = read_uint16( file, "fmt-sample-size" );
+
+    // The real format of WAVE_FORMAT_EXTENSIBLE is in the SubFormat GUID
+    if (fmt->audioFormat == WAVE_FORMAT_EXTENSIBLE && chunkSize >= 40) {
+        read_uint16( file, "fmt-extra-size" );
+        read_uint16( file, "fmt-valid-bits" );
+        read_uint32( file, "fmt-channel-mask" );
+        fmt->subFormat = read_uint16( file, "fmt-sub-format" );
+    } else if ((fmt->audioFormat == WAVE_FORMAT_MS_ADPCM ||
+                fmt->audioFormat == WAVE_FORMAT_IMA_ADPCM) && chunkSize >= 20) {
+        read_uint16( file, "fmt-extra-size" );
+        fmt->samplesPerBlock = read_uint16( file, "fmt-samples-per-block" );
+    }
+}
+
+
+// The format tag describing the samples, looking inside extensible formats
+uint16_t
+wave_sample_format( const wave_format_t* fmt )
+{
+    if (fmt->audioFormat == WAVE_FORMAT_EXTENSIBLE)
+        return fmt->subFormat;
+    return fmt->audioFormat;
+}
+
+
+
+// Little-endian writers for building chunks in memory;
+// each returns the position after what it wrote
+uint8_t*
+wave_put_uint32( uint8_t* p, uint32_t x )
+{
+    p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+    return p+4;
+}
+
+uint8_t*
+wave_put_uint16( uint8_t* p, uint16_t x )
+{
+    p[0] = x; p[1] = x >> 8;
+    return p+2;
+}
+
+uint8_t*
+wave_put_chunk_header( uint8_t* p, const char* type, uint32_t size )
+{
+    memcpy( p, type, 4 );
+    return wave_put_uint32( p+4, size );
+}
+
+
+// Write the RIFF, 'fmt ' and (if needed) 'fact' chunks, followed by
+// copies of the metadata chunks from metaFd and the 'data' chunk header.
+// The payload of dataSize bytes should be written straight after.
+void
+wave_write_header( int fd, const wave_format_t* fmt, uint32_t dataSize,
+                   int metaFd, const wave_chunk_t* meta, int metaCount )
+{
+    int isPCM = (fmt->audioFormat == WAVE_FORMAT_PCM);
+    uint32_t fmtSize = isPCM ? 16 : 18;
+    uint64_t riffSize = 4 + 8 + fmtSize + 8 + dataSize + (dataSize & 1);
+    uint8_t header[64];
+    uint8_t * p = header;
+    int n;
+
+    // Non-PCM formats should have a fact chunk with the sample count
+    if (!isPCM) riffSize += 12;
+    for (n=0; n<metaCount; n++)
+        riffSize += 8 + meta[n].size + (meta[n].size & 1);
+    if (riffSize > UINT32_MAX)
+        handle_error( "Output is too large for a WAVE file." );
+
+    p = wave_put_chunk_header( p, "RIFF", riffSize );
+    memcpy( p, "WAVE", 4 ); p += 4;
+
+    p = wave_put_chunk_header( p, "fmt ", fmtSize );
+    p = wave_put_uint16( p, fmt->audioFormat );
+    p = wave_put_uint16( p, fmt->channels );
+    p = wave_put_uint32( p, fmt->sampleRate );
+    p = wave_put_uint32( p, fmt->byteRate );
+    p = wave_put_uint16( p, fmt->blockAlign );
+    p = wave_put_uint16( p, fmt->sampleSize );
+    if (!isPCM) {
+        p = wave_put_uint16( p, 0 );
+        p = wave_put_chunk_header( p, "fact", 4 );
+        p = wave_put_uint32( p, fmt->blockAlign ? dataSize / fmt->blockAlign : 0 );
+    }
+    write_bytes( fd, header, p - header );
+
+    // Copy the metadata chunks across unchanged
+    for (n=0; n<metaCount; n++) {
+        uint32_t size = meta[n].size + (meta[n].size & 1);
+        uint8_t * buffer = calloc( 1, size + 8 );
+        ssize_t got;
+
+        if (!buffer) handle_error( "Unable to allocate memory for chunk." );
+        wave_put_chunk_header( buffer, meta[n].type, meta[n].size );
+        got = pread( metaFd, buffer+8, meta[n].size, meta[n].seek );
+        if (got != meta[n].size)
+            handle_error( "Unable to read chunk from input file." );
+        write_bytes( fd, buffer, size + 8 );
+        free( buffer );
+    }
+
+    p = wave_put_chunk_header( header, "data", dataSize );
+    write_bytes( fd, header, p - header );
+}
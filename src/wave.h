@@ -0,0 +1,71 @@
+/*
+    wave.h
+    Writing RIFF/WAVE headers for the files produced by the tools
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#ifndef _WAVE_H
+#define _WAVE_H
+
+#define WAVE_FORMAT_PCM         1
+#define WAVE_FORMAT_MS_ADPCM    2
+#define WAVE_FORMAT_FLOAT       3
+#define WAVE_FORMAT_G711_ALAW   6
+#define WAVE_FORMAT_G711_MULAW  7
+#define WAVE_FORMAT_IMA_ADPCM   17
+#define WAVE_FORMAT_MPEG        80
+#define WAVE_FORMAT_MPEGLAYER3  85
+#define WAVE_FORMAT_MULAW       257
+#define WAVE_FORMAT_ALAW        258
+#define WAVE_FORMAT_ADPCM       259
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+
+// Contents of a 'fmt ' chunk
+typedef struct {
+    uint16_t audioFormat;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t sampleSize;
+    uint16_t subFormat;     // Format tag from the GUID of an extensible fmt
+    uint16_t samplesPerBlock;   // For ADPCM formats
+} wave_format_t;
+
+
+// A chunk in an input file, to be copied to an output file
+typedef struct {
+    char     type[4];
+    uint32_t seek;          // Offset of the chunk payload
+    uint32_t size;
+} wave_chunk_t;
+
+
+void wave_read_format( FILE* file, uint32_t chunkSize, wave_format_t* fmt );
+uint16_t wave_sample_format( const wave_format_t* fmt );
+
+uint8_t* wave_put_uint16( uint8_t* p, uint16_t x );
+uint8_t* wave_put_uint32( uint8_t* p, uint32_t x );
+uint8_t* wave_put_chunk_header( uint8_t* p, const char* type, uint32_t size );
+
+void wave_write_header( int fd, const wave_format_t* fmt, uint32_t dataSize,
+                        int metaFd, const wave_chunk_t* meta, int metaCount );
+
+#endif //_WAVE_H
@@ -0,0 +1,890 @@
+/*
+    wavebatch.c
+    Convert many BSI style MPEG Audio WAVE files to tagged MP3 files
+
+    Does the same job as running bsiwave_to_mpeg on each file, but
+    without starting any other programs: the MPEG Audio is unwrapped
+    with a Xing/Info header and the metadata is written straight into
+    an ID3v2 tag. Files are converted in parallel on a pool of workers,
+    which steal work from each other when they run out; large files are
+    copied in segments, so that they can be shared between workers too.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "util.h"
+#include "copy.h"
+#include "mpeg.h"
+#include "wave.h"
+#include "arena.h"
+#include "meta.h"
+#include "id3.h"
+
+
+#define COPY_BUFFER_SIZE    (1024*1024)
+#define PEEK_BUFFER_SIZE    8192
+#define ID3V1_SIZE          128
+#define DEFAULT_IO_LIMIT    4
+#define DEFAULT_SPLIT_SIZE  (64*1024*1024)
+
+#define TASK_FILE           1       // Read the metadata and start the output
+#define TASK_SEGMENT        2       // Copy part of the audio
+
+
+typedef struct {
+    char *   inpath;
+    char *   outpath;
+    char *   tmppath;
+    off_t    fileSize;
+    time_t   mtime;
+
+    int      in_fd;
+    int      out_fd;
+    uint32_t dataSeek;      // Start of the MPEG Audio in the input
+    uint32_t dataSize;
+    off_t    outDataPos;    // Start of the MPEG Audio in the output
+    off_t    xingPos;
+    int      xingSize;
+    mpeg_header_t xing;
+    mpeg_index_t index;
+    int      indexDuringCopy;
+
+    pthread_mutex_t lock;
+    int      segmentsLeft;
+    int      failed;
+} file_job_t;
+
+typedef struct {
+    int type;
+    file_job_t * file;
+    uint64_t offset;
+    uint64_t length;
+} task_t;
+
+// Each worker takes tasks from the end of its own deque, and
+// steals from the start of the others' when its own is empty
+typedef struct {
+    pthread_mutex_t lock;
+    task_t * tasks;
+    size_t head, tail, alloc;
+    uint8_t * buffer;
+    meta_info_t meta;       // Reused for each file the worker starts
+    int index;
+} worker_t;
+
+
+// Map from wavemetainfo keys to ID3v2 frames, as used by bsiwave_to_mpeg
+static const struct {
+    const char * key;
+    const char * frame;
+} tag_map[] = {
+    { "disp-title", "TIT2" },
+    { "info-iart", "TPE1" },
+    { "info-ialb", "TALB" },
+    { "info-iyer", "TYER" },
+    { "info-itrk", "TRCK" },
+    { "info-icmt", "COMM,eng," },
+    { "info-isrf", "TXXX,Intro" },
+    { "info-imed", "TXXX,Sec Tone" },
+    { "info-isrc", "TXXX,Category" },
+    { "info-bfad", "TXXX,No fade" },
+    { "info-igre", "TCON" },
+    { "info-ieng", "TXXX,Producer" },
+    { "info-itch", "TXXX,Talent" },
+    { "info-icom", "TCOM" },
+    { "info-ipub", "TPUB" },
+    { "info-bcpr", "TCOP" },
+    { "info-inam", "TXXX,OutCue" },
+    { "info-icop", "TXXX,Agency" },
+    { "info-isft", "TXXX,Account Exec" },
+    { "info-isbj", "TXXX,Copy" },
+    { "info-iurl", "TXXX,URL" },
+    { "info-ibpm", "TXXX,BPM" },
+    { "info-bkey", "TXXX,Key" },
+    { "info-bend", "TXXX,End" },
+    { "info-berg", "TXXX,Energy" },
+    { "info-btxr", "TXXX,Texture" },
+    { "info-btpo", "TXXX,Tempo" },
+    { "info-hkst", "TXXX,Hook End" },      // The script maps hkst twice; the last one wins
+    { "info-ignr", "TXXX,Start Date" },
+    { "info-ikey", "TXXX,End Date" },
+    { "info-bstm", "TXXX,Start Time" },
+    { "info-betm", "TXXX,End Time" },
+    { "info-bstw", "TXXX,Start Window" },
+    { "info-betw", "TXXX,End Window" },
+    { NULL, NULL }
+};
+
+
+// Globals
+int workerCount = 0;
+int ioLimit = DEFAULT_IO_LIMIT;
+uint64_t splitSize = DEFAULT_SPLIT_SIZE;
+int force = 0;
+int quiet = 0;
+const char * outputDir = NULL;
+
+file_job_t * files = NULL;
+size_t fileCount = 0;
+size_t fileAlloc = 0;
+worker_t * workers = NULL;
+
+// Scheduling: tasks waiting in any deque, and files not yet finished
+pthread_mutex_t schedLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t schedCond = PTHREAD_COND_INITIALIZER;
+size_t tasksQueued = 0;
+size_t filesLeft = 0;
+
+// Number of workers reading or writing at once
+pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ioCond = PTHREAD_COND_INITIALIZER;
+int ioActive = 0;
+
+// Progress
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t statsCond = PTHREAD_COND_INITIALIZER;
+uint64_t bytesTotal = 0;
+uint64_t bytesDone = 0;
+size_t filesDone = 0;
+size_t filesFailed = 0;
+size_t filesSkipped = 0;
+int finished = 0;
+
+
+
+static void
+io_acquire()
+{
+    pthread_mutex_lock( &ioLock );
+    while (ioActive >= ioLimit)
+        pthread_cond_wait( &ioCond, &ioLock );
+    ioActive++;
+    pthread_mutex_unlock( &ioLock );
+}
+
+
+static void
+io_release()
+{
+    pthread_mutex_lock( &ioLock );
+    ioActive--;
+    pthread_cond_signal( &ioCond );
+    pthread_mutex_unlock( &ioLock );
+}
+
+
+static void
+add_bytes( uint64_t bytes )
+{
+    pthread_mutex_lock( &statsLock );
+    bytesDone += bytes;
+    pthread_mutex_unlock( &statsLock );
+}
+
+
+
+/* ---- Work stealing ---- */
+
+static void
+push_task( worker_t* worker, int type, file_job_t* file, uint64_t offset, uint64_t length )
+{
+    task_t* task;
+
+    pthread_mutex_lock( &worker->lock );
+    if (worker->tail == worker->alloc) {
+        if (worker->head > 0) {
+            memmove( worker->tasks, worker->tasks + worker->head,
+                     (worker->tail - worker->head) * sizeof(task_t) );
+            worker->tail -= worker->head;
+            worker->head = 0;
+        } else {
+            worker->alloc = worker->alloc ? worker->alloc*2 : 64;
+            worker->tasks = realloc( worker->tasks, worker->alloc * sizeof(task_t) );
+            if (!worker->tasks) handle_error("unable to allocate memory for task list");
+        }
+    }
+    task = &worker->tasks[ worker->tail++ ];
+    task->type = type;
+    task->file = file;
+    task->offset = offset;
+    task->length = length;
+    pthread_mutex_unlock( &worker->lock );
+
+    pthread_mutex_lock( &schedLock );
+    tasksQueued++;
+    pthread_cond_signal( &schedCond );
+    pthread_mutex_unlock( &schedLock );
+}
+
+
+// Take the newest task from a worker's own deque, or the oldest from another's
+static int
+take_task( worker_t* worker, worker_t* victim, task_t* task )
+{
+    int found = 0;
+
+    pthread_mutex_lock( &victim->lock );
+    if (victim->tail > victim->head) {
+        if (victim == worker) *task = victim->tasks[ --victim->tail ];
+        else *task = victim->tasks[ victim->head++ ];
+        found = 1;
+    }
+    pthread_mutex_unlock( &victim->lock );
+
+    if (found) {
+        pthread_mutex_lock( &schedLock );
+        tasksQueued--;
+        pthread_mutex_unlock( &schedLock );
+    }
+
+    return found;
+}
+
+
+// Wait for a task; returns 0 once every file is finished
+static int
+next_task( worker_t* worker, task_t* task )
+{
+    for (;;) {
+        int n;
+
+        if (take_task( worker, worker, task )) return 1;
+        for (n=1; n<workerCount; n++) {
+            if (take_task( worker, &workers[ (worker->index + n) % workerCount ], task ))
+                return 1;
+        }
+
+        pthread_mutex_lock( &schedLock );
+        while (tasksQueued == 0 && filesLeft > 0)
+            pthread_cond_wait( &schedCond, &schedLock );
+        n = (filesLeft == 0);
+        pthread_mutex_unlock( &schedLock );
+        if (n) return 0;
+    }
+}
+
+
+
+/* ---- Conversion ---- */
+
+static void
+file_done( file_job_t* file, int failed )
+{
+    pthread_mutex_lock( &statsLock );
+    filesDone++;
+    if (failed) filesFailed++;
+    pthread_mutex_unlock( &statsLock );
+
+    pthread_mutex_lock( &schedLock );
+    if (--filesLeft == 0) pthread_cond_broadcast( &schedCond );
+    pthread_mutex_unlock( &schedLock );
+}
+
+
+// Fill in the Xing frame, set the date and move the output into place
+static void
+finish_file( worker_t* worker, file_job_t* file )
+{
+    if (!file->failed && file->xingSize) {
+        uint8_t * frame = NULL;
+
+        // The audio was copied in pieces, so index it now (from the page cache)
+        if (!file->indexDuringCopy) {
+            uint64_t pos = 0;
+
+            io_acquire();
+            while (pos < file->dataSize) {
+                size_t want = file->dataSize - pos < COPY_BUFFER_SIZE ? file->dataSize - pos : COPY_BUFFER_SIZE;
+                ssize_t res = pread( file->out_fd, worker->buffer, want, file->outDataPos + pos );
+                if (res < 0 && errno == EINTR) continue;
+                if (res <= 0) {
+                    file->failed = 1;
+                    break;
+                }
+                mpeg_index_feed( &file->index, worker->buffer, res );
+                pos += res;
+            }
+            io_release();
+        }
+
+        frame = malloc( file->xingSize );
+        if (!frame) handle_error("unable to allocate memory for Xing frame");
+        mpeg_xing_build( &file->index, &file->xing, frame );
+        if (pwrite( file->out_fd, frame, file->xingSize, file->xingPos ) != file->xingSize)
+            file->failed = 1;
+        free( frame );
+    }
+
+    if (!file->failed) {
+        // Give the output the modification date of the input
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_NOW;
+        times[1].tv_sec = file->mtime;
+        times[1].tv_nsec = 0;
+        futimens( file->out_fd, times );
+    }
+
+    if (close( file->out_fd )) file->failed = 1;
+    close( file->in_fd );
+    mpeg_index_free( &file->index );
+
+    if (file->failed || rename( file->tmppath, file->outpath )) {
+        fprintf(stderr, "Warning: failed to convert '%s'.\n", file->inpath);
+        unlink( file->tmppath );
+        file_done( file, 1 );
+    } else {
+        file_done( file, 0 );
+    }
+}
+
+
+static void
+copy_segment( worker_t* worker, file_job_t* file, uint64_t offset, uint64_t length )
+{
+    int left;
+
+    io_acquire();
+    while (length && !file->failed) {
+        size_t want = length < COPY_BUFFER_SIZE ? length : COPY_BUFFER_SIZE;
+        ssize_t res = pread( file->in_fd, worker->buffer, want, file->dataSeek + offset );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0 || pwrite( file->out_fd, worker->buffer, res, file->outDataPos + offset ) != res) {
+            pthread_mutex_lock( &file->lock );
+            file->failed = 1;
+            pthread_mutex_unlock( &file->lock );
+            break;
+        }
+        if (file->indexDuringCopy)
+            mpeg_index_feed( &file->index, worker->buffer, res );
+        add_bytes( res );
+        offset += res;
+        length -= res;
+    }
+    io_release();
+
+    // Whoever copies the last segment finishes the file
+    pthread_mutex_lock( &file->lock );
+    left = --file->segmentsLeft;
+    pthread_mutex_unlock( &file->lock );
+
+    if (left == 0) finish_file( worker, file );
+}
+
+
+// Work out where the MPEG Audio is, skipping any ID3 tags inside the data chunk
+static void
+trim_payload( file_job_t* file )
+{
+    uint8_t buf[ID3V1_SIZE];
+    size_t size;
+
+    if (pread( file->in_fd, buf, 10, file->dataSeek ) == 10) {
+        size = id3_v2_size( buf, 10 );
+        if (size && size < file->dataSize) {
+            file->dataSeek += size;
+            file->dataSize -= size;
+        }
+    }
+
+    if (file->dataSize > ID3V1_SIZE &&
+        pread( file->in_fd, buf, ID3V1_SIZE, file->dataSeek + file->dataSize - ID3V1_SIZE ) == ID3V1_SIZE &&
+        memcmp( buf, "TAG", 3 )==0) {
+        file->dataSize -= ID3V1_SIZE;
+    }
+}
+
+
+// Read the metadata, write the ID3 tag and space for the Xing frame,
+// then queue the audio to be copied
+static void
+start_file( worker_t* worker, file_job_t* file )
+{
+    uint8_t peek[PEEK_BUFFER_SIZE];
+    meta_info_t* info = &worker->meta;
+    id3_tag_t tag;
+    mpeg_header_t first;
+    uint64_t segments, n;
+    ssize_t peekLen;
+    int offset;
+    FILE * input;
+
+    io_acquire();
+
+    input = fopen( file->inpath, "r" );
+    if (input == NULL || meta_read( input, info )) {
+        fprintf(stderr, "Warning: '%s' isn't a WAVE file.\n", file->inpath);
+        if (input) fclose( input );
+        io_release();
+        add_bytes( file->fileSize );
+        file_done( file, 1 );
+        return;
+    }
+    fclose( input );
+
+    if (info->format.audioFormat != WAVE_FORMAT_MPEG &&
+        info->format.audioFormat != WAVE_FORMAT_MPEGLAYER3) {
+        fprintf(stderr, "Warning: audio in '%s' isn't MPEG Audio.\n", file->inpath);
+        io_release();
+        add_bytes( file->fileSize );
+        file_done( file, 1 );
+        return;
+    }
+
+    file->in_fd = open( file->inpath, O_RDONLY );
+    file->out_fd = open( file->tmppath, O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if (file->in_fd < 0 || file->out_fd < 0) {
+        fprintf(stderr, "Warning: unable to open '%s'.\n", file->in_fd < 0 ? file->inpath : file->tmppath);
+        if (file->in_fd >= 0) close( file->in_fd );
+        if (file->out_fd >= 0) {
+            close( file->out_fd );
+            unlink( file->tmppath );
+        }
+        io_release();
+        add_bytes( file->fileSize );
+        file_done( file, 1 );
+        return;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise( file->in_fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    // A data chunk running past the end of the file is cut short
+    file->dataSeek = info->dataSeek;
+    file->dataSize = info->dataSize;
+    if (file->dataSeek > file->fileSize) file->dataSize = 0;
+    else if (file->dataSize > file->fileSize - file->dataSeek)
+        file->dataSize = file->fileSize - file->dataSeek;
+    trim_payload( file );
+
+    // The tag goes first, then the Xing frame, then the audio
+    id3_init( &tag );
+    for (n=0; tag_map[n].key; n++) {
+        const char* value = meta_get( info, tag_map[n].key );
+        if (value) id3_add_frame( &tag, tag_map[n].frame, value );
+    }
+    id3_finish( &tag );
+
+    file->xingPos = tag.len;
+    peekLen = pread( file->in_fd, peek, file->dataSize < sizeof(peek) ? file->dataSize : sizeof(peek), file->dataSeek );
+    offset = peekLen > 0 ? mpeg_find_header( peek, peekLen, &first ) : -1;
+    if (offset >= 0 && !mpeg_has_vbr_header( peek+offset, peekLen-offset, &first ))
+        file->xingSize = mpeg_xing_size( &first, &file->xing );
+    file->outDataPos = file->xingPos + file->xingSize;
+
+    // Write the tag and a placeholder for the Xing frame
+    {
+        uint8_t * head = arena_alloc( &info->arena, file->outDataPos );
+        memcpy( head, tag.data, tag.len );
+        memset( head + tag.len, 0, file->xingSize );
+        if (pwrite( file->out_fd, head, file->outDataPos, 0 ) != file->outDataPos)
+            file->failed = 1;
+    }
+    id3_free( &tag );
+
+#ifdef HAVE_FALLOCATE
+    fallocate( file->out_fd, 0, file->outDataPos, file->dataSize );
+#endif
+
+    io_release();
+
+    // Count the rest of the input as done, so that progress is by input bytes
+    add_bytes( file->fileSize - file->dataSize );
+
+    mpeg_index_init( &file->index );
+    segments = (file->dataSize + splitSize - 1) / splitSize;
+    if (segments <= 1) {
+        file->segmentsLeft = 1;
+        file->indexDuringCopy = 1;
+        copy_segment( worker, file, 0, file->dataSize );
+        return;
+    }
+
+    // Queue the segments so that this worker starts on the first one,
+    // and other workers steal from the end
+    file->segmentsLeft = segments;
+    for (n=segments; n>0; n--) {
+        uint64_t start = (n-1) * splitSize;
+        uint64_t len = (n == segments) ? file->dataSize - start : splitSize;
+        push_task( worker, TASK_SEGMENT, file, start, len );
+    }
+}
+
+
+static void*
+worker_thread( void* arg )
+{
+    worker_t* worker = arg;
+    task_t task;
+
+    while (next_task( worker, &task )) {
+        if (task.type == TASK_FILE) start_file( worker, task.file );
+        else copy_segment( worker, task.file, task.offset, task.length );
+    }
+
+    return NULL;
+}
+
+
+
+/* ---- Progress ---- */
+
+static void
+print_progress( double elapsed, int last )
+{
+    double rate;
+    uint64_t done;
+    size_t count;
+
+    pthread_mutex_lock( &statsLock );
+    done = bytesDone;
+    count = filesDone;
+    pthread_mutex_unlock( &statsLock );
+
+    rate = elapsed > 0 ? done / elapsed : 0;
+    fprintf(stderr, "%lu/%lu files, %.1f/%.1f MB, %.1f MB/s",
+            (unsigned long)count, (unsigned long)fileCount,
+            done / 1048576.0, bytesTotal / 1048576.0, rate / 1048576.0);
+    if (!last && rate > 0) {
+        long eta = (bytesTotal - done) / rate;
+        fprintf(stderr, ", %ld:%02ld left", eta / 60, eta % 60);
+    }
+    fprintf(stderr, last ? "\n" : (isatty(2) ? "    \r" : "\n"));
+}
+
+
+static void*
+progress_thread( void* arg )
+{
+    double start = *(double*)arg;
+    int interval = isatty(2) ? 1 : 10;
+
+    pthread_mutex_lock( &statsLock );
+    while (!finished) {
+        struct timespec until;
+        until.tv_sec = time(NULL) + interval;
+        until.tv_nsec = 0;
+        pthread_cond_timedwait( &statsCond, &statsLock, &until );
+        if (finished) break;
+
+        pthread_mutex_unlock( &statsLock );
+        print_progress( now() - start, 0 );
+        pthread_mutex_lock( &statsLock );
+    }
+    pthread_mutex_unlock( &statsLock );
+
+    return NULL;
+}
+
+
+
+/* ---- Building the list of files ---- */
+
+static void
+add_file( const char* path, const struct stat* st )
+{
+    file_job_t* file;
+    const char* base = strrchr( path, '/' );
+    size_t len;
+    char * name;
+
+    base = base ? base+1 : path;
+    len = strlen( base );
+    if (len > 4 && strcasecmp( base + len - 4, ".wav" )==0) len -= 4;
+
+    if (fileCount == fileAlloc) {
+        fileAlloc = fileAlloc ? fileAlloc*2 : 1024;
+        files = realloc( files, fileAlloc * sizeof(file_job_t) );
+        if (!files) handle_error("unable to allocate memory for file list");
+    }
+
+    file = &files[ fileCount++ ];
+    memset( file, 0, sizeof(file_job_t) );
+    file->inpath = strdup( path );
+    file->fileSize = st->st_size;
+    file->mtime = st->st_mtime;
+
+    name = malloc( len + 1 );
+    file->outpath = malloc( strlen(outputDir) + len + 6 );
+    file->tmppath = malloc( strlen(outputDir) + len + 12 );
+    if (!file->inpath || !name || !file->outpath || !file->tmppath)
+        handle_error("unable to allocate memory for file list");
+    memcpy( name, base, len );
+    name[len] = 0;
+    sprintf( file->outpath, "%s/%s.mp3", outputDir, name );
+    sprintf( file->tmppath, "%s/.%s.mp3.part", outputDir, name );
+    free( name );
+}
+
+
+static int
+walk_callback( const char* path, const struct stat* st, int type, struct FTW* ftw )
+{
+    size_t len = strlen( path );
+
+    if (type == FTW_F && S_ISREG(st->st_mode) && len > 4 &&
+        strcasecmp( path + len - 4, ".wav" )==0 && path[ftw->base] != '.') {
+        add_file( path, st );
+    } else if (type == FTW_DNR || type == FTW_NS) {
+        fprintf(stderr, "Warning: unable to read '%s'.\n", path);
+    }
+    return 0;
+}
+
+
+static void
+add_path( const char* path )
+{
+    struct stat st;
+
+    if (stat( path, &st )) {
+        fprintf(stderr, "Warning: unable to stat '%s'.\n", path);
+    } else if (S_ISDIR(st.st_mode)) {
+        if (nftw( path, walk_callback, 64, FTW_PHYS ))
+            fprintf(stderr, "Warning: unable to read folder '%s'.\n", path);
+    } else {
+        add_file( path, &st );
+    }
+}
+
+
+static void
+read_list( const char* listname )
+{
+    char line[8192];
+    FILE* list = strcmp(listname, "-") ? fopen( listname, "r" ) : stdin;
+
+    if (list == NULL) handle_error("unable to open list of files");
+    while (fgets( line, sizeof(line), list )) {
+        line[ strcspn(line, "\r\n") ] = 0;
+        if (line[0]) add_path( line );
+    }
+    if (list != stdin) fclose( list );
+}
+
+
+static int
+compare_output( const void* a, const void* b )
+{
+    return strcmp( ((const file_job_t*)a)->outpath, ((const file_job_t*)b)->outpath );
+}
+
+
+static int
+compare_size( const void* a, const void* b )
+{
+    const file_job_t* fa = a;
+    const file_job_t* fb = b;
+    if (fa->fileSize != fb->fileSize) return fa->fileSize > fb->fileSize ? -1 : 1;
+    return strcmp( fa->outpath, fb->outpath );
+}
+
+
+// Drop files which would overwrite each other, and outputs that are up to date
+static void
+prune_files()
+{
+    size_t n, kept = 0;
+
+    qsort( files, fileCount, sizeof(file_job_t), compare_output );
+
+    for (n=0; n<fileCount; n++) {
+        file_job_t* file = &files[n];
+        struct stat out;
+
+        if (kept && strcmp( files[kept-1].outpath, file->outpath )==0) {
+            fprintf(stderr, "Warning: skipping '%s', which has the same name as '%s'.\n",
+                    file->inpath, files[kept-1].inpath);
+            filesSkipped++;
+            continue;
+        }
+
+        // Outputs are given the modification date of their input
+        if (!force && stat( file->outpath, &out )==0 &&
+            out.st_mtime == file->mtime && out.st_size > 0) {
+            filesSkipped++;
+            continue;
+        }
+
+        files[kept++] = *file;
+    }
+    fileCount = kept;
+
+    // Start the biggest files first, so that the pool finishes together
+    qsort( files, fileCount, sizeof(file_job_t), compare_size );
+}
+
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <output folder> [<file or folder>...]\n\n", progname);
+    fprintf(stderr, "   -l <file>   Read the files to convert from a list ('-' for stdin)\n");
+    fprintf(stderr, "   -j <count>  Number of worker threads (default: CPUs)\n");
+    fprintf(stderr, "   -I <count>  Number of workers reading or writing at once (default %d)\n", DEFAULT_IO_LIMIT);
+    fprintf(stderr, "   -S <size>   Copy files bigger than this in segments (default %dM)\n", DEFAULT_SPLIT_SIZE/(1024*1024));
+    fprintf(stderr, "   -f          Convert files even if the output is up to date\n");
+    fprintf(stderr, "   -q          Don't display progress\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    pthread_t * pool = NULL;
+    pthread_t progress;
+    char * listname = NULL;
+    double start;
+    size_t n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:j:I:S:fqh")) != -1) {
+        switch (opt) {
+            case 'l':
+                listname = optarg;
+                break;
+            case 'j':
+                workerCount = atoi( optarg );
+                if (workerCount < 1) usage( argv[0] );
+                break;
+            case 'I':
+                ioLimit = atoi( optarg );
+                if (ioLimit < 1) usage( argv[0] );
+                break;
+            case 'S':
+                splitSize = copy_parse_size( optarg );
+                if (splitSize == 0) usage( argv[0] );
+                break;
+            case 'f':
+                force = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind<1) usage( argv[0] );
+    outputDir = argv[optind++];
+
+    if (workerCount < 1) workerCount = sysconf( _SC_NPROCESSORS_ONLN );
+    if (workerCount < 1) workerCount = 1;
+
+    {
+        struct stat st;
+        if (stat(outputDir, &st) || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Error: output must be a folder.\n");
+            exit(1);
+        }
+    }
+
+
+    // Build the list of files
+    if (listname) read_list( listname );
+    for (; optind<argc; optind++) {
+        add_path( argv[optind] );
+    }
+
+    prune_files();
+    for (n=0; n<fileCount; n++) {
+        bytesTotal += files[n].fileSize;
+        pthread_mutex_init( &files[n].lock, NULL );
+    }
+    filesLeft = fileCount;
+
+
+    // Deal the files out to the workers, biggest first
+    workers = calloc( workerCount, sizeof(worker_t) );
+    pool = calloc( workerCount, sizeof(pthread_t) );
+    if (!workers || !pool) handle_error("unable to allocate memory for workers");
+
+    for (n=0; n<workerCount; n++) {
+        workers[n].index = n;
+        workers[n].buffer = malloc( COPY_BUFFER_SIZE );
+        if (!workers[n].buffer) handle_error("unable to allocate memory for copy buffers");
+        meta_init( &workers[n].meta );
+        pthread_mutex_init( &workers[n].lock, NULL );
+    }
+    for (n=fileCount; n>0; n--) {
+        // Each worker takes from the end of its own deque, so push the smallest first
+        push_task( &workers[ (n-1) % workerCount ], TASK_FILE, &files[n-1], 0, 0 );
+    }
+
+    start = now();
+    if (!quiet && pthread_create( &progress, NULL, progress_thread, &start ))
+        handle_error("unable to start progress thread");
+
+    for (n=0; n<workerCount; n++) {
+        if (pthread_create( &pool[n], NULL, worker_thread, &workers[n] ))
+            handle_error("unable to start worker thread");
+    }
+    for (n=0; n<workerCount; n++) {
+        pthread_join( pool[n], NULL );
+    }
+
+    if (!quiet) {
+        pthread_mutex_lock( &statsLock );
+        finished = 1;
+        pthread_cond_signal( &statsCond );
+        pthread_mutex_unlock( &statsLock );
+        pthread_join( progress, NULL );
+
+        print_progress( now() - start, 1 );
+        fprintf(stderr, "Converted %lu files, %lu failed, %lu skipped.\n",
+                (unsigned long)(filesDone - filesFailed), (unsigned long)filesFailed,
+                (unsigned long)filesSkipped);
+    }
+
+    for (n=0; n<workerCount; n++) {
+        free( workers[n].buffer );
+        free( workers[n].tasks );
+        meta_free( &workers[n].meta );
+    }
+    free( workers );
+    free( pool );
+
+    return filesFailed ? 1 : 0;
+}
@@ -0,0 +1,709 @@
+/*
+    wavededupe.c
+    Find WAVE files containing identical audio, ignoring metadata chunks
+
+    Only the payload of the 'data' chunk is compared. Files are first
+    grouped by payload size, then by a hash of the first block of the
+    payload, and only files which still collide get a full hash. Files
+    with the same full hash are then compared byte by byte, so that a
+    hash collision is never reported as a duplicate.
+    Results are saved to a cache file, so later runs only hash files
+    which are new or have changed.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "util.h"
+#include "hash.h"
+
+
+#define HEAD_BLOCK_SIZE     (64*1024)
+#define HASH_BUFFER_SIZE    (1024*1024)
+#define CACHE_HEADER        "wavededupe-cache 1"
+
+// File state flags
+#define FILE_SCANNED        0x01
+#define FILE_HEAD           0x02
+#define FILE_FULL           0x04
+#define FILE_INVALID        0x08
+
+
+typedef struct wave_file_s {
+    char *   path;
+    time_t   mtime;
+    off_t    fileSize;
+    uint32_t dataSeek;
+    uint32_t dataSize;
+    uint64_t headHash;
+    uint64_t fullHash;
+    int      flags;
+    int      match;         // Files with the same hash but different audio
+    int      checked;       // Compared with the first file of its group
+    struct wave_file_s * first;
+} wave_file_t;
+
+typedef void (*file_func_t)( wave_file_t* file );
+
+typedef struct {
+    wave_file_t ** files;
+    size_t count;
+    size_t next;
+    file_func_t func;
+    pthread_mutex_t lock;
+} work_queue_t;
+
+
+// Globals
+int debug = 0;
+int threads = 0;
+wave_file_t * files = NULL;
+size_t fileCount = 0;
+size_t fileAlloc = 0;
+wave_file_t * cache = NULL;
+size_t cacheCount = 0;
+static _Thread_local uint8_t * workerBuffer = NULL;
+
+
+
+static wave_file_t*
+add_file( const char* path, const struct stat* st )
+{
+    wave_file_t* file;
+
+    if (fileCount == fileAlloc) {
+        fileAlloc = fileAlloc ? fileAlloc*2 : 1024;
+        files = realloc( files, fileAlloc * sizeof(wave_file_t) );
+        if (!files) handle_error("unable to allocate memory for file list");
+    }
+
+    file = &files[ fileCount++ ];
+    memset( file, 0, sizeof(wave_file_t) );
+    file->path = strdup( path );
+    file->mtime = st->st_mtime;
+    file->fileSize = st->st_size;
+    if (!file->path) handle_error("unable to allocate memory for file list");
+
+    return file;
+}
+
+
+static int
+walk_callback( const char* path, const struct stat* st, int type, struct FTW* ftw )
+{
+    if (type == FTW_F && S_ISREG(st->st_mode)) {
+        add_file( path, st );
+    } else if (type == FTW_DNR || type == FTW_NS) {
+        fprintf(stderr, "Warning: unable to read '%s'.\n", path);
+    }
+    return 0;
+}
+
+
+static int
+compare_path( const void* a, const void* b )
+{
+    return strcmp( ((const wave_file_t*)a)->path, ((const wave_file_t*)b)->path );
+}
+
+
+
+// Load the results of a previous run
+static void
+load_cache( const char* filename )
+{
+    char line[8192];
+    size_t alloc = 0;
+    FILE* file = fopen( filename, "r" );
+
+    // It is fine for the cache not to exist yet
+    if (file == NULL) return;
+
+    if (fgets(line, sizeof(line), file) == NULL ||
+        strncmp(line, CACHE_HEADER, strlen(CACHE_HEADER)) != 0) {
+        fprintf(stderr, "Warning: ignoring invalid cache file '%s'.\n", filename);
+        fclose( file );
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        wave_file_t entry;
+        long long mtime, fileSize;
+        unsigned long long headHash, fullHash;
+        int pathStart = 0;
+
+        memset( &entry, 0, sizeof(entry) );
+        line[ strcspn(line, "\n") ] = 0;
+        if (sscanf(line, "%lld %lld %u %u %d %llx %llx %n",
+                   &mtime, &fileSize, &entry.dataSeek, &entry.dataSize,
+                   &entry.flags, &headHash, &fullHash, &pathStart) < 7 || !pathStart)
+            continue;
+
+        entry.mtime = mtime;
+        entry.fileSize = fileSize;
+        entry.headHash = headHash;
+        entry.fullHash = fullHash;
+        entry.path = strdup( line + pathStart );
+        if (!entry.path) handle_error("unable to allocate memory for cache");
+
+        if (cacheCount == alloc) {
+            alloc = alloc ? alloc*2 : 1024;
+            cache = realloc( cache, alloc * sizeof(wave_file_t) );
+            if (!cache) handle_error("unable to allocate memory for cache");
+        }
+        cache[ cacheCount++ ] = entry;
+    }
+
+    fclose( file );
+
+    qsort( cache, cacheCount, sizeof(wave_file_t), compare_path );
+}
+
+
+// Copy across anything we already know about unchanged files
+// Files that couldn't be read are looked at again, as that may not last
+static void
+apply_cache()
+{
+    size_t n;
+
+    for (n=0; n<fileCount; n++) {
+        wave_file_t* file = &files[n];
+        wave_file_t* entry = bsearch( file, cache, cacheCount, sizeof(wave_file_t), compare_path );
+
+        if (entry && entry->mtime == file->mtime && entry->fileSize == file->fileSize &&
+            !(entry->flags & FILE_INVALID)) {
+            file->dataSeek = entry->dataSeek;
+            file->dataSize = entry->dataSize;
+            file->headHash = entry->headHash;
+            file->fullHash = entry->fullHash;
+            file->flags = entry->flags;
+        }
+    }
+}
+
+
+static void
+save_cache( const char* filename )
+{
+    char * tmpname = malloc( strlen(filename) + 5 );
+    FILE * file = NULL;
+    size_t n;
+
+    if (!tmpname) handle_error("unable to allocate memory for cache");
+    sprintf( tmpname, "%s.tmp", filename );
+
+    file = fopen( tmpname, "w" );
+    if (file == NULL) handle_error("unable to open cache file for writing");
+
+    fprintf( file, "%s\n", CACHE_HEADER );
+    for (n=0; n<fileCount; n++) {
+        wave_file_t* f = &files[n];
+        if (!f->flags || (f->flags & FILE_INVALID)) continue;
+        fprintf( file, "%lld %lld %u %u %d %016llx %016llx %s\n",
+                 (long long)f->mtime, (long long)f->fileSize,
+                 f->dataSeek, f->dataSize, f->flags,
+                 (unsigned long long)f->headHash,
+                 (unsigned long long)f->fullHash, f->path );
+    }
+
+    if (fclose( file ) || rename( tmpname, filename ))
+        handle_error("unable to write cache file");
+
+    free( tmpname );
+}
+
+
+
+// Each worker's read buffer, allocated when it is first needed
+static uint8_t*
+worker_buffer()
+{
+    if (!workerBuffer) workerBuffer = malloc( HASH_BUFFER_SIZE );
+    if (!workerBuffer) handle_error("unable to allocate memory for read buffer");
+    return workerBuffer;
+}
+
+
+// Hash len bytes of a file starting at offset
+static int
+hash_range( int fd, off_t offset, uint64_t len, uint8_t* buffer, uint64_t* result )
+{
+    hash_state_t state;
+
+    hash_init( &state );
+    while (len) {
+        size_t want = len < HASH_BUFFER_SIZE ? len : HASH_BUFFER_SIZE;
+        ssize_t res = pread( fd, buffer, want, offset );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+        hash_update( &state, buffer, res );
+        offset += res;
+        len -= res;
+    }
+
+    *result = hash_digest( &state );
+    return 0;
+}
+
+
+static void
+scan_file( wave_file_t* file )
+{
+    FILE* input = fopen( file->path, "r" );
+
+    file->flags = FILE_SCANNED;
+    if (input == NULL || find_data_chunk( input, &file->dataSeek, &file->dataSize )) {
+        if (debug) fprintf(stderr, "Warning: no WAVE data chunk in '%s'.\n", file->path);
+        file->flags |= FILE_INVALID;
+    }
+    if (input) fclose( input );
+}
+
+
+static void
+hash_file( wave_file_t* file, int full )
+{
+    uint64_t len = file->dataSize;
+    uint64_t hash = 0;
+    int fd;
+
+    if (!full && len > HEAD_BLOCK_SIZE) len = HEAD_BLOCK_SIZE;
+
+    fd = open( file->path, O_RDONLY );
+    if (fd < 0) {
+        fprintf(stderr, "Warning: unable to open '%s'.\n", file->path);
+        file->flags |= FILE_INVALID;
+        return;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    if (full) posix_fadvise( fd, file->dataSeek, len, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    if (hash_range( fd, file->dataSeek, len, worker_buffer(), &hash )) {
+        fprintf(stderr, "Warning: data chunk of '%s' is truncated.\n", file->path);
+        file->flags |= FILE_INVALID;
+    } else if (full) {
+        file->fullHash = hash;
+        file->flags |= FILE_FULL;
+    } else {
+        file->headHash = hash;
+        file->flags |= FILE_HEAD;
+
+        // The first block is the whole payload
+        if (len == file->dataSize) {
+            file->fullHash = hash;
+            file->flags |= FILE_FULL;
+        }
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    // Don't let a large archive scan push everything else out of the cache
+    if (full) posix_fadvise( fd, file->dataSeek, len, POSIX_FADV_DONTNEED );
+#endif
+
+    close( fd );
+}
+
+static void
+hash_head( wave_file_t* file )
+{
+    hash_file( file, 0 );
+}
+
+static void
+hash_full( wave_file_t* file )
+{
+    hash_file( file, 1 );
+}
+
+
+// Compare the payload of a file with the first file of its group;
+// one that differs is moved on to a group of its own
+static void
+check_file( wave_file_t* file )
+{
+    uint8_t * a = worker_buffer();
+    uint8_t * b = a + HASH_BUFFER_SIZE/2;
+    uint64_t pos = 0, len = file->dataSize;
+    int fa = open( file->first->path, O_RDONLY );
+    int fb = open( file->path, O_RDONLY );
+    int same = (fa >= 0 && fb >= 0);
+
+    while (same && pos < len) {
+        size_t want = len-pos < HASH_BUFFER_SIZE/2 ? len-pos : HASH_BUFFER_SIZE/2;
+        ssize_t ra = pread( fa, a, want, file->first->dataSeek + pos );
+        ssize_t rb = pread( fb, b, want, file->dataSeek + pos );
+        if (ra < 0 && errno == EINTR) continue;
+        if (rb < 0 && errno == EINTR) continue;
+        if (ra <= 0 || rb <= 0 || ra != rb) {
+            // Changed or unreadable since it was hashed
+            fprintf(stderr, "Warning: unable to compare '%s'.\n", file->path);
+            file->flags |= FILE_INVALID;
+            break;
+        }
+        same = (memcmp( a, b, ra ) == 0);
+        pos += ra;
+    }
+
+    if (fa < 0 || fb < 0) {
+        fprintf(stderr, "Warning: unable to open '%s'.\n", fa < 0 ? file->first->path : file->path);
+        file->flags |= FILE_INVALID;
+    } else if (!same) {
+        if (debug) fprintf(stderr, "Hash collision: '%s'.\n", file->path);
+        file->match++;
+    }
+
+    // One that differs is checked again against the first of its new group
+    file->checked = same;
+
+    if (fa >= 0) close( fa );
+    if (fb >= 0) close( fb );
+}
+
+
+
+static void*
+worker_thread( void* arg )
+{
+    work_queue_t* queue = arg;
+
+    for (;;) {
+        size_t n;
+
+        pthread_mutex_lock( &queue->lock );
+        n = queue->next++;
+        pthread_mutex_unlock( &queue->lock );
+
+        if (n >= queue->count) break;
+        queue->func( queue->files[n] );
+    }
+
+    free( workerBuffer );
+    workerBuffer = NULL;
+    return NULL;
+}
+
+
+// Run func on each of the files, using a pool of threads
+static void
+run_parallel( wave_file_t** list, size_t count, file_func_t func )
+{
+    pthread_t * pool = NULL;
+    work_queue_t queue;
+    int n, poolSize = threads;
+
+    if (count == 0) return;
+    if (poolSize > count) poolSize = count;
+
+    memset( &queue, 0, sizeof(queue) );
+    queue.files = list;
+    queue.count = count;
+    queue.func = func;
+    pthread_mutex_init( &queue.lock, NULL );
+
+    pool = calloc( poolSize, sizeof(pthread_t) );
+    if (!pool) handle_error("unable to allocate memory for thread pool");
+
+    for (n=0; n<poolSize; n++) {
+        if (pthread_create( &pool[n], NULL, worker_thread, &queue ))
+            handle_error("unable to start worker thread");
+    }
+    for (n=0; n<poolSize; n++) {
+        pthread_join( pool[n], NULL );
+    }
+
+    pthread_mutex_destroy( &queue.lock );
+    free( pool );
+}
+
+
+
+static int
+compare_size( const void* a, const void* b )
+{
+    const wave_file_t* fa = *(wave_file_t* const*)a;
+    const wave_file_t* fb = *(wave_file_t* const*)b;
+    if (fa->dataSize != fb->dataSize) return fa->dataSize > fb->dataSize ? -1 : 1;
+    return strcmp( fa->path, fb->path );
+}
+
+static int
+compare_head( const void* a, const void* b )
+{
+    const wave_file_t* fa = *(wave_file_t* const*)a;
+    const wave_file_t* fb = *(wave_file_t* const*)b;
+    if (fa->dataSize != fb->dataSize) return fa->dataSize > fb->dataSize ? -1 : 1;
+    if (fa->headHash != fb->headHash) return fa->headHash < fb->headHash ? -1 : 1;
+    return strcmp( fa->path, fb->path );
+}
+
+static int
+compare_full( const void* a, const void* b )
+{
+    const wave_file_t* fa = *(wave_file_t* const*)a;
+    const wave_file_t* fb = *(wave_file_t* const*)b;
+    if (fa->dataSize != fb->dataSize) return fa->dataSize > fb->dataSize ? -1 : 1;
+    if (fa->fullHash != fb->fullHash) return fa->fullHash < fb->fullHash ? -1 : 1;
+    if (fa->match != fb->match) return fa->match - fb->match;
+    return strcmp( fa->path, fb->path );
+}
+
+
+static int
+same_size( const wave_file_t* a, const wave_file_t* b )
+{
+    return a->dataSize == b->dataSize;
+}
+
+static int
+same_head( const wave_file_t* a, const wave_file_t* b )
+{
+    return a->dataSize == b->dataSize && a->headHash == b->headHash;
+}
+
+static int
+same_full( const wave_file_t* a, const wave_file_t* b )
+{
+    return a->dataSize == b->dataSize && a->fullHash == b->fullHash &&
+           a->match == b->match;
+}
+
+
+// Sort the list and keep only files which share a key with another file
+static size_t
+keep_collisions( wave_file_t** list, size_t count,
+                 int (*compare)(const void*, const void*),
+                 int (*same)(const wave_file_t*, const wave_file_t*) )
+{
+    size_t start = 0, kept = 0;
+
+    qsort( list, count, sizeof(wave_file_t*), compare );
+
+    while (start < count) {
+        size_t end = start+1;
+        while (end < count && same( list[start], list[end] )) end++;
+        if (end - start > 1) {
+            memmove( &list[kept], &list[start], (end-start) * sizeof(wave_file_t*) );
+            kept += end - start;
+        }
+        start = end;
+    }
+
+    return kept;
+}
+
+
+// Build a list of the files in the candidate list without a flag set
+static size_t
+files_without( wave_file_t** list, size_t count, int flag, wave_file_t** todo )
+{
+    size_t n, todoCount = 0;
+
+    for (n=0; n<count; n++) {
+        if (!(list[n]->flags & flag)) todo[todoCount++] = list[n];
+    }
+
+    return todoCount;
+}
+
+
+// Remove files that turned out to be unreadable
+static size_t
+remove_invalid( wave_file_t** list, size_t count )
+{
+    size_t n, kept = 0;
+
+    for (n=0; n<count; n++) {
+        if (!(list[n]->flags & FILE_INVALID) && list[n]->dataSize)
+            list[kept++] = list[n];
+    }
+
+    return kept;
+}
+
+
+static void
+print_groups( wave_file_t** list, size_t count )
+{
+    size_t start = 0;
+    int group = 0;
+
+    while (start < count) {
+        size_t n, end = start+1;
+        while (end < count && same_full( list[start], list[end] )) end++;
+
+        printf("group: %d\n", ++group);
+        printf("data-size: %u\n", list[start]->dataSize);
+        printf("data-hash: %016llx\n", (unsigned long long)list[start]->fullHash);
+        for (n=start; n<end; n++) {
+            printf("file: %s\n", list[n]->path);
+        }
+        printf("\n");
+
+        start = end;
+    }
+}
+
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <file or directory>...\n\n", progname);
+    fprintf(stderr, "   -c <file>   Cache results in file, to speed up later runs\n");
+    fprintf(stderr, "   -j <count>  Number of files to process in parallel (default: CPUs)\n");
+    fprintf(stderr, "   -d          Display debugging information\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    wave_file_t ** list = NULL;
+    wave_file_t ** todo = NULL;
+    char * cachename = NULL;
+    size_t n, count, todoCount;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:j:dh")) != -1) {
+        switch (opt) {
+            case 'c':
+                cachename = optarg;
+                break;
+            case 'j':
+                threads = atoi( optarg );
+                if (threads < 1) usage( argv[0] );
+                break;
+            case 'd':
+                debug = 1;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind<1) usage( argv[0] );
+
+    if (threads < 1) threads = sysconf( _SC_NPROCESSORS_ONLN );
+    if (threads < 1) threads = 1;
+
+
+    // Build the list of files
+    for (; optind<argc; optind++) {
+        struct stat fileInfo;
+        if (stat(argv[optind], &fileInfo)) handle_error("unable to stat file");
+
+        if (S_ISDIR(fileInfo.st_mode)) {
+            if (nftw(argv[optind], walk_callback, 64, FTW_PHYS))
+                handle_error("unable to walk directory");
+        } else {
+            add_file( argv[optind], &fileInfo );
+        }
+    }
+
+    if (cachename) {
+        load_cache( cachename );
+        apply_cache();
+    }
+
+    list = calloc( fileCount+1, sizeof(wave_file_t*) );
+    todo = calloc( fileCount+1, sizeof(wave_file_t*) );
+    if (!list || !todo) handle_error("unable to allocate memory for file list");
+    for (n=0; n<fileCount; n++) list[n] = &files[n];
+    count = fileCount;
+
+
+    // Find the data chunk of every file
+    todoCount = files_without( list, count, FILE_SCANNED, todo );
+    if (debug) fprintf(stderr, "Scanning %lu of %lu files\n", (unsigned long)todoCount, (unsigned long)count);
+    run_parallel( todo, todoCount, scan_file );
+    count = remove_invalid( list, count );
+    count = keep_collisions( list, count, compare_size, same_size );
+
+    // Hash the first block of files with the same payload size
+    todoCount = files_without( list, count, FILE_HEAD, todo );
+    if (debug) fprintf(stderr, "Hashing first block of %lu files\n", (unsigned long)todoCount);
+    run_parallel( todo, todoCount, hash_head );
+    count = remove_invalid( list, count );
+    count = keep_collisions( list, count, compare_head, same_head );
+
+    // Hash the whole payload of files that still collide
+    // (largest first, so that the pool finishes together)
+    todoCount = files_without( list, count, FILE_FULL, todo );
+    if (debug) fprintf(stderr, "Hashing whole payload of %lu files\n", (unsigned long)todoCount);
+    qsort( todo, todoCount, sizeof(wave_file_t*), compare_size );
+    run_parallel( todo, todoCount, hash_full );
+    count = remove_invalid( list, count );
+    count = keep_collisions( list, count, compare_full, same_full );
+
+    // Compare files with the same hash against the first of their group,
+    // until every group has been confirmed
+    for (;;) {
+        size_t start, end;
+
+        todoCount = 0;
+        for (start = 0; start < count; start = end) {
+            list[start]->checked = 1;
+            for (end = start+1; end < count && same_full( list[start], list[end] ); end++) {
+                if (list[end]->checked) continue;
+                list[end]->first = list[start];
+                todo[todoCount++] = list[end];
+            }
+        }
+        if (todoCount == 0) break;
+
+        if (debug) fprintf(stderr, "Comparing payload of %lu files\n", (unsigned long)todoCount);
+        qsort( todo, todoCount, sizeof(wave_file_t*), compare_size );
+        run_parallel( todo, todoCount, check_file );
+        count = remove_invalid( list, count );
+        count = keep_collisions( list, count, compare_full, same_full );
+    }
+
+    print_groups( list, count );
+
+    if (cachename) save_cache( cachename );
+
+    free( todo );
+    free( list );
+
+    // Success !
+    return 0;
+}
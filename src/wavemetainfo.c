@@ -31,6 +31,7 @@
 
 #include "config.h"
 #include "util.h"
+#include "arena.h"
 
 // Windows clipboard types
 #define CF_TEXT             1
@@ -57,12 +58,17 @@
 #define CF_DSPMETAFILEPICT  0x0083
 #define CF_DSPENHMETAFILE   0x008E
 
+// Variable length fields at the end of a cart chunk
+#define CART_URL_SIZE       1024
+#define CART_TAGTEXT_OFFSET 2048
+
 
 
 // Globals
 int debug = 0;
 uint32_t byteRate = 0;
 uint32_t audioDataLen = 0;
+arena_t textArena;
 
 
 typedef struct {
@@ -107,12 +113,11 @@ typedef struct {
 void
 read_print_text(FILE* file, uint32_t strLen)
 {
-    char* data = malloc(strLen+1);
+    char* data = arena_alloc(&textArena, strLen+1);
     if (fread(data, strLen, 1, file)!=1)
         handle_error("unable to read text");
     data[strLen] = 0;
     printf("%s\n", data);
-    free(data);
 }
 
 
@@ -276,7 +281,13 @@ proccessCartChunk( FILE *file, uint32_t chunkSize )
 		}
 	}
 	
+	// Skip the reserved bytes
+	if (chunkSize < CART_TAGTEXT_OFFSET || fseek(file, 276, SEEK_CUR)!=0)
+		return;
+
 	// ** URL Text **
+	printf("cart-url: ");
+	read_print_text( file, CART_URL_SIZE );
 
 	// ** Tag Text **
 }
@@ -333,6 +344,13 @@ proccessLISTChunk( FILE *file, uint32_t chunkSize )
 
         // Remove the length of the sub-sub type and size 
         chunkSize -= sizeof(info_type)+sizeof(subSize)+subSize;
+
+        // Sub-chunks are padded to an even length
+        if ((subSize & 1) && chunkSize) {
+            if (fseek(file, 1, SEEK_CUR))
+                handle_error("unable to skip INFO padding");
+            chunkSize--;
+        }
     }
 
 }
@@ -479,9 +497,9 @@ proccessChunk(FILE* file, int seek)
     }
 
     
-    // Read in the sub chunks
+    // Read in the sub chunks (stopping at the pad byte after odd sized data)
     subSeek = ftell(file);
-    while(subSeek < nextChunk) {
+    while(subSeek + 8 <= nextChunk) {
     
         subSeek = proccessSubChunk( file, subSeek );
     
@@ -529,6 +547,7 @@ main(int argc, char **argv)
     filename = argv[optind];
     byteRate = 0;
     audioDataLen = 0;
+    arena_init( &textArena, 0 );
     
     
     // Display the filename
@@ -545,6 +564,7 @@ main(int argc, char **argv)
     // Get chunks until the next chunk is
     // beyond the end of the file
     while (seek < fileInfo.st_size) {
+        arena_reset( &textArena );
         seek = proccessChunk( file, seek );
     }
     
@@ -554,6 +574,7 @@ main(int argc, char **argv)
     
     // Close the file
     fclose(file);
+    arena_free( &textArena );
     
     // Success !
     return 0;
@@ -0,0 +1,618 @@
+/*
+    waveprewarm.c
+    Read carts into the page cache before they are due to be played
+
+    A playout log gives the time that each file goes to air. Shortly
+    before that, the audio in its data chunk is read ahead into the page
+    cache, in the order that the files will be played and within a limit
+    on the memory and disk bandwidth used. Once a file has finished
+    playing it is dropped from the cache again. When each file goes to
+    air, how much of it is in the cache and how long its first bytes
+    take to read are recorded, to show whether prewarming is working.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "util.h"
+#include "copy.h"
+#include "wave.h"
+#include "arena.h"
+#include "meta.h"
+
+
+#define DEFAULT_LOOKAHEAD   600             // seconds
+#define DEFAULT_KEEP        60              // seconds
+#define DEFAULT_MEMORY      (256*1024*1024)
+#define WARM_CHUNK_SIZE     (1024*1024)
+#define FIRST_BLOCK_SIZE    (64*1024)       // What a player reads first
+#define MAX_SLEEP           1.0
+
+// Item states
+#define ITEM_WAITING        0       // Not looked at yet
+#define ITEM_WARMING        1       // Audio range known
+#define ITEM_AIRED          2       // Gone to air, and playing
+#define ITEM_DONE           3       // Finished, and dropped from the cache
+
+
+typedef struct {
+    char *   path;
+    time_t   airTime;
+    double   endTime;       // When it can be dropped from the cache
+    off_t    start;         // Audio data range within the file
+    off_t    length;
+    off_t    warmed;        // Bytes of the range read ahead so far
+    int      state;
+    size_t   line;          // Position in the log, for sorting
+} item_t;
+
+
+// Globals
+int debug = 0;
+int readData = 0;
+int lookahead = DEFAULT_LOOKAHEAD;
+int keepTime = DEFAULT_KEEP;
+size_t memoryLimit = DEFAULT_MEMORY;
+size_t bandwidthLimit = 0;          // bytes per second, or 0 for no limit
+volatile sig_atomic_t stopping = 0;
+volatile sig_atomic_t statsWanted = 0;
+
+item_t * items = NULL;
+size_t itemCount = 0;
+size_t itemAlloc = 0;
+size_t nextWarm = 0;                // First item which may still need warming
+off_t memoryUsed = 0;               // Bytes warmed for items not yet dropped
+double tokens = 0;                  // Bandwidth which may be used now
+double tokenTime = 0;
+uint8_t * readBuffer = NULL;
+meta_info_t meta;
+
+// Statistics
+unsigned long statAired = 0;
+unsigned long statHits = 0;
+unsigned long statMisses = 0;
+unsigned long statMissing = 0;
+unsigned long statPast = 0;
+uint64_t statWarmed = 0;
+uint64_t statDropped = 0;
+double statResident = 0;            // Sum of the fraction of each item cached
+unsigned long statResidentCount = 0;
+double statLatencySum = 0;
+double statLatencyMax = 0;
+
+
+
+// Parse 'YYYY-MM-DD HH:MM:SS' or 'HH:MM:SS' (today) at the start of a line
+// Returns the number of characters used, or 0 if there isn't a time
+static int
+parse_time( const char* str, time_t* result )
+{
+    time_t today = time( NULL );
+    int year, month, day, hour, min, sec;
+    struct tm tm;
+    int used = 0;
+
+    localtime_r( &today, &tm );
+    if (sscanf( str, "%d-%d-%d%*[ T]%d:%d:%d%n", &year, &month, &day,
+                &hour, &min, &sec, &used ) == 6) {
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+    } else if (sscanf( str, "%d:%d:%d%n", &hour, &min, &sec, &used ) != 3) {
+        return 0;
+    }
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+
+    tm.tm_isdst = -1;
+    *result = mktime( &tm );
+    return *result == (time_t)-1 ? 0 : used;
+}
+
+
+// Read '<air time> <path>' lines; blank lines and comments are skipped
+static void
+load_log( FILE* file )
+{
+    char line[4096];
+    unsigned long lineNum = 0;
+
+    while (fgets( line, sizeof(line), file )) {
+        item_t * item;
+        time_t airTime;
+        char * path;
+        int used;
+
+        lineNum++;
+        line[ strcspn(line, "\r\n") ] = 0;
+        if (line[0] == 0 || line[0] == '#') continue;
+
+        used = parse_time( line, &airTime );
+        path = line + used + strspn( line + used, " \t" );
+        if (used == 0 || path == line + used || *path == 0) {
+            fprintf(stderr, "Warning: ignoring line %lu of playout log.\n", lineNum);
+            continue;
+        }
+
+        if (itemCount == itemAlloc) {
+            itemAlloc = itemAlloc ? itemAlloc * 2 : 256;
+            items = realloc( items, itemAlloc * sizeof(item_t) );
+            if (!items) handle_error("unable to allocate memory for playout log");
+        }
+        item = &items[ itemCount++ ];
+        memset( item, 0, sizeof(item_t) );
+        item->path = strdup( path );
+        item->airTime = airTime;
+        item->line = lineNum;
+        if (!item->path) handle_error("unable to allocate memory for playout log");
+    }
+}
+
+
+// Keep items which air at the same time in the order they were logged
+static int
+compare_items( const void* a, const void* b )
+{
+    const item_t* x = a;
+    const item_t* y = b;
+
+    if (x->airTime != y->airTime) return x->airTime < y->airTime ? -1 : 1;
+    return x->line < y->line ? -1 : (x->line > y->line);
+}
+
+
+
+// Work out which bytes of the file are audio, and when it stops playing
+static void
+prepare_item( size_t n )
+{
+    item_t * item = &items[n];
+    double duration = 0;
+    struct stat st;
+    FILE * file;
+
+    item->state = ITEM_WARMING;
+    file = fopen( item->path, "r" );
+    if (file == NULL || fstat( fileno(file), &st )) {
+        if (file) fclose( file );
+        if (debug) fprintf(stderr, "Unable to open '%s'.\n", item->path);
+        return;
+    }
+
+    if (meta_read( file, &meta ) == 0 && meta.dataSeek <= st.st_size) {
+        item->start = meta.dataSeek;
+        item->length = meta.dataSize;
+        if (item->length > st.st_size - item->start)
+            item->length = st.st_size - item->start;
+        if (meta.format.byteRate)
+            duration = (double)meta.dataSize / meta.format.byteRate;
+    } else {
+        // Not a WAVE file; all of it is needed
+        item->start = 0;
+        item->length = st.st_size;
+    }
+    fclose( file );
+
+    // Without a duration, assume it plays until the next item
+    if (duration == 0 && n+1 < itemCount)
+        duration = items[n+1].airTime - item->airTime;
+    item->endTime = item->airTime + duration + keepTime;
+
+    if (debug) fprintf(stderr, "Warming '%s': %lu bytes at %lu.\n", item->path,
+                       (unsigned long)item->length, (unsigned long)item->start);
+}
+
+
+// Read ahead the next block of an item
+// Returns the number of bytes read ahead, or -1 on failure
+static ssize_t
+warm_block( item_t* item, size_t len )
+{
+    off_t offset = item->start + item->warmed;
+    int fd = open( item->path, O_RDONLY );
+    ssize_t res = -1;
+
+    if (fd < 0) return -1;
+
+    if (!readData) {
+#ifdef HAVE_READAHEAD
+        if (readahead( fd, offset, len ) == 0) res = len;
+#endif
+#ifdef HAVE_POSIX_FADVISE
+        if (res < 0 && posix_fadvise( fd, offset, len, POSIX_FADV_WILLNEED ) == 0) res = len;
+#endif
+    }
+
+    // Some network filesystems ignore hints; read it for real
+    if (res < 0) {
+        size_t got = 0;
+        while (got < len) {
+            ssize_t r = pread( fd, readBuffer, len - got, offset + got );
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            got += r;
+        }
+        res = got ? got : -1;
+    }
+
+    close( fd );
+    return res;
+}
+
+
+// Warm the items due soon, in the order they will be played,
+// giving up once something else is due at the deadline
+// Returns the time to wait before there is more to do
+static double
+warm_items( double deadline )
+{
+    while (nextWarm < itemCount) {
+        item_t * item = &items[ nextWarm ];
+        size_t len = WARM_CHUNK_SIZE;
+        double t = now();
+        ssize_t res;
+
+        if (t >= deadline) return 0;
+        if (item->state == ITEM_WAITING) {
+            if (item->airTime - lookahead > t) return item->airTime - lookahead - t;
+            prepare_item( nextWarm );
+        }
+        if (item->state != ITEM_WARMING || item->warmed >= item->length) {
+            nextWarm++;
+            continue;
+        }
+
+        // Keep within the memory budget; the start of a big file is
+        // better than nothing
+        if (len > item->length - item->warmed) len = item->length - item->warmed;
+        if (len > memoryLimit - memoryUsed) len = memoryLimit - memoryUsed;
+        if (memoryUsed >= memoryLimit || len == 0) return MAX_SLEEP;
+
+        // And within the bandwidth budget, allowing a second's burst
+        if (bandwidthLimit) {
+            tokens += (t - tokenTime) * bandwidthLimit;
+            if (tokens > bandwidthLimit) tokens = bandwidthLimit;
+            tokenTime = t;
+            if (len > bandwidthLimit) len = bandwidthLimit;
+            if (tokens < len) return (len - tokens) / bandwidthLimit;
+            tokens -= len;
+        }
+
+        res = warm_block( item, len );
+        if (res < 0) {
+            if (debug) fprintf(stderr, "Unable to read ahead '%s'.\n", item->path);
+            nextWarm++;
+            continue;
+        }
+        item->warmed += res;
+        memoryUsed += res;
+        statWarmed += res;
+        if (stopping || statsWanted) return 0;
+    }
+
+    return MAX_SLEEP;
+}
+
+
+// When the next item goes to air, or an item can be dropped
+static double
+next_event( size_t first )
+{
+    double due = now() + MAX_SLEEP;
+    size_t n;
+
+    for (n=first; n<itemCount; n++) {
+        if (items[n].state == ITEM_AIRED && items[n].endTime < due)
+            due = items[n].endTime;
+        if (items[n].state < ITEM_AIRED) {
+            if (items[n].airTime < due) due = items[n].airTime;
+            break;
+        }
+    }
+    return due;
+}
+
+
+// Fraction of a range of a file which is in the page cache,
+// or -1 if it can't be found out
+static double
+resident_fraction( int fd, off_t start, off_t length )
+{
+    double fraction = -1;
+#ifdef HAVE_MINCORE
+    long pageSize = sysconf( _SC_PAGESIZE );
+    off_t mapStart = start & ~(off_t)(pageSize-1);
+    size_t mapLen = length + (start - mapStart);
+    size_t pages = (mapLen + pageSize - 1) / pageSize;
+    unsigned char * vec;
+    void * map;
+    size_t n, resident = 0;
+
+    if (length <= 0) return -1;
+    map = mmap( NULL, mapLen, PROT_READ, MAP_SHARED, fd, mapStart );
+    if (map == MAP_FAILED) return -1;
+
+    vec = malloc( pages );
+    if (vec && mincore( map, mapLen, vec ) == 0) {
+        for (n=0; n<pages; n++) resident += vec[n] & 1;
+        fraction = (double)resident / pages;
+    }
+
+    free( vec );
+    munmap( map, mapLen );
+#endif
+    return fraction;
+}
+
+
+// The item is going to air: see how much of it is ready
+static void
+air_item( item_t* item )
+{
+    off_t first = item->length < FIRST_BLOCK_SIZE ? item->length : FIRST_BLOCK_SIZE;
+    double whole, head, latency, start;
+    int fd;
+
+    item->state = ITEM_AIRED;
+    fd = open( item->path, O_RDONLY );
+    if (fd < 0) {
+        statMissing++;
+        if (debug) fprintf(stderr, "Missing '%s' at air time.\n", item->path);
+        return;
+    }
+
+    whole = resident_fraction( fd, item->start, item->length );
+    head = resident_fraction( fd, item->start, first );
+
+    // Time reading the first block, as the player is about to
+    start = now();
+    if (first > 0 && pread( fd, readBuffer, first, item->start ) < 0)
+        fprintf(stderr, "Warning: unable to read '%s'.\n", item->path);
+    latency = now() - start;
+    close( fd );
+
+    statAired++;
+    statLatencySum += latency;
+    if (latency > statLatencyMax) statLatencyMax = latency;
+    if (whole >= 0) {
+        statResident += whole;
+        statResidentCount++;
+    }
+    if (head >= 1.0) statHits++;
+    else if (head >= 0) statMisses++;
+
+    if (debug && whole >= 0) fprintf(stderr, "On air '%s': %.0f%% cached, first bytes in %.2f ms.\n",
+                                     item->path, whole * 100, latency * 1000);
+    else if (debug) fprintf(stderr, "On air '%s': first bytes in %.2f ms.\n",
+                            item->path, latency * 1000);
+}
+
+
+// The item has finished playing; drop it from the cache,
+// unless it is going to be played again soon
+static void
+drop_item( size_t n )
+{
+    item_t * item = &items[n];
+    size_t i;
+
+    item->state = ITEM_DONE;
+    memoryUsed -= item->warmed;
+    if (item->warmed == 0) return;
+
+    for (i=n+1; i<itemCount; i++) {
+        if (items[i].state != ITEM_DONE && strcmp( items[i].path, item->path )==0 &&
+            items[i].airTime - lookahead <= now()) return;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    {
+        int fd = open( item->path, O_RDONLY );
+        if (fd >= 0) {
+            posix_fadvise( fd, item->start, item->length, POSIX_FADV_DONTNEED );
+            close( fd );
+        }
+    }
+#endif
+    statDropped += item->warmed;
+    if (debug) fprintf(stderr, "Dropped '%s'.\n", item->path);
+}
+
+
+static void
+print_stats( FILE* out )
+{
+    fprintf(out, "prewarm-items: %lu\n", (unsigned long)itemCount);
+    fprintf(out, "prewarm-aired: %lu\n", statAired);
+    fprintf(out, "prewarm-hits: %lu\n", statHits);
+    fprintf(out, "prewarm-misses: %lu\n", statMisses);
+    fprintf(out, "prewarm-missing: %lu\n", statMissing);
+    fprintf(out, "prewarm-past: %lu\n", statPast);
+    if (statResidentCount)
+        fprintf(out, "prewarm-cached-percent: %.1f\n", statResident * 100 / statResidentCount);
+    if (statAired) {
+        fprintf(out, "prewarm-first-byte-avg-ms: %.3f\n", statLatencySum * 1000 / statAired);
+        fprintf(out, "prewarm-first-byte-max-ms: %.3f\n", statLatencyMax * 1000);
+    }
+    fprintf(out, "prewarm-warmed-bytes: %llu\n", (unsigned long long)statWarmed);
+    fprintf(out, "prewarm-dropped-bytes: %llu\n", (unsigned long long)statDropped);
+    fprintf(out, "prewarm-memory-bytes: %llu\n", (unsigned long long)memoryUsed);
+    fflush(out);
+}
+
+
+static void
+handle_signal( int sig )
+{
+    if (sig == SIGUSR1) statsWanted = 1;
+    else stopping = 1;
+}
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <playout log>\n\n", progname);
+    fprintf(stderr, "   -a <secs>   Start reading files this long before they air (default %d)\n", DEFAULT_LOOKAHEAD);
+    fprintf(stderr, "   -k <secs>   Keep files cached this long after they finish (default %d)\n", DEFAULT_KEEP);
+    fprintf(stderr, "   -m <size>   Most memory to fill with files yet to finish (default %dM)\n", DEFAULT_MEMORY/(1024*1024));
+    fprintf(stderr, "   -b <size>   Most to read per second (default no limit)\n");
+    fprintf(stderr, "   -r          Read the audio, rather than asking the kernel to read ahead\n");
+    fprintf(stderr, "   -d          Display debugging information\n");
+    fprintf(stderr, "Each line of the log is '[YYYY-MM-DD] HH:MM:SS <path>'; '-' reads it from standard input.\n");
+    fprintf(stderr, "Send SIGUSR1 to print the statistics so far.\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct sigaction sa;
+    size_t n, firstLive = 0;
+    FILE * log;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:k:m:b:rdh")) != -1) {
+        switch (opt) {
+            case 'a':
+                lookahead = atoi( optarg );
+                if (lookahead < 0) usage( argv[0] );
+                break;
+            case 'k':
+                keepTime = atoi( optarg );
+                if (keepTime < 0) usage( argv[0] );
+                break;
+            case 'm':
+                memoryLimit = copy_parse_size( optarg );
+                if (memoryLimit == 0) usage( argv[0] );
+                break;
+            case 'b':
+                bandwidthLimit = copy_parse_size( optarg );
+                if (bandwidthLimit == 0) usage( argv[0] );
+                break;
+            case 'r':
+                readData = 1;
+                break;
+            case 'd':
+                debug = 1;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind!=1) usage( argv[0] );
+
+    // Read the schedule
+    if (strcmp(argv[optind], "-")==0) {
+        log = stdin;
+    } else {
+        log = fopen( argv[optind], "r" );
+        if (log == NULL) handle_error("unable to open playout log");
+    }
+    load_log( log );
+    if (log != stdin) fclose( log );
+    qsort( items, itemCount, sizeof(item_t), compare_items );
+
+    // Anything which should already have started is too late
+    for (n=0; n<itemCount && items[n].airTime < time( NULL ); n++) {
+        items[n].state = ITEM_DONE;
+        statPast++;
+    }
+    nextWarm = firstLive = n;
+
+    readBuffer = malloc( WARM_CHUNK_SIZE > FIRST_BLOCK_SIZE ? WARM_CHUNK_SIZE : FIRST_BLOCK_SIZE );
+    if (!readBuffer) handle_error("unable to allocate memory for read buffer");
+    meta_init( &meta );
+    tokenTime = now();
+
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = handle_signal;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+    sigaction( SIGUSR1, &sa, NULL );
+
+    while (!stopping && firstLive < itemCount) {
+        double t = now();
+        double wait, deadline;
+
+        // Items going to air, and items which have finished
+        for (n=firstLive; n<itemCount && items[n].airTime <= t; n++) {
+            if (items[n].state < ITEM_AIRED) {
+                if (items[n].state == ITEM_WAITING) prepare_item( n );
+                air_item( &items[n] );
+            }
+            if (items[n].state == ITEM_AIRED && items[n].endTime <= t)
+                drop_item( n );
+        }
+        while (firstLive < itemCount && items[firstLive].state == ITEM_DONE)
+            firstLive++;
+        if (nextWarm < firstLive) nextWarm = firstLive;
+
+        deadline = next_event( firstLive );
+        wait = warm_items( deadline );
+
+        // Sleep until the next item airs or finishes, if that is sooner
+        if (deadline - now() < wait) wait = deadline - now();
+
+        if (statsWanted) {
+            statsWanted = 0;
+            print_stats( stdout );
+        }
+
+        if (wait > MAX_SLEEP) wait = MAX_SLEEP;
+        if (wait > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)wait;
+            ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+            nanosleep( &ts, NULL );
+        }
+    }
+
+    print_stats( stdout );
+
+    for (n=0; n<itemCount; n++) free( items[n].path );
+    free( items );
+    free( readBuffer );
+    meta_free( &meta );
+
+    return 0;
+}
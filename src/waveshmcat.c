@@ -0,0 +1,166 @@
+/*
+    waveshmcat.c
+    Read audio streamed through shared memory by waveunwrap --shm
+
+    A reference player for the ring buffer: waits for waveunwrap to
+    publish the format, then writes the audio out as it arrives, either
+    as a WAVE file or raw. With -v it reports how long the format and
+    the first audio took to arrive.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "shmring.h"
+
+
+#define READ_BUFFER_SIZE    (64*1024)
+#define DEFAULT_TIMEOUT     10
+
+
+// Write a WAVE header with the source's own fmt and fact chunks,
+// so that formats with extra fmt fields are described correctly
+static void
+write_header( int fd, const shmring_header_t* h )
+{
+    uint8_t header[SHMRING_FMT_SIZE + 64];
+    uint8_t * p = header;
+    uint64_t riffSize;
+
+    if (h->fmtSize == 0) {
+        if (h->format.audioFormat != WAVE_FORMAT_PCM) {
+            fprintf(stderr, "Error: the format of the audio can't be passed on; use -r.\n");
+            exit(2);
+        }
+        wave_write_header( fd, &h->format, h->dataSize, -1, NULL, 0 );
+        return;
+    }
+
+    riffSize = 4 + 8 + h->fmtSize + (h->fmtSize & 1) + 8 + h->dataSize + (h->dataSize & 1);
+    if (h->hasFact) riffSize += 12;
+    if (riffSize > UINT32_MAX)
+        handle_error( "Output is too large for a WAVE file." );
+
+    p = wave_put_chunk_header( p, "RIFF", riffSize );
+    memcpy( p, "WAVE", 4 ); p += 4;
+    p = wave_put_chunk_header( p, "fmt ", h->fmtSize );
+    memcpy( p, h->fmtChunk, h->fmtSize ); p += h->fmtSize;
+    if (h->fmtSize & 1) *p++ = 0;
+    if (h->hasFact) {
+        p = wave_put_chunk_header( p, "fact", 4 );
+        p = wave_put_uint32( p, h->factSamples );
+    }
+    p = wave_put_chunk_header( p, "data", h->dataSize );
+    write_bytes( fd, header, p - header );
+}
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <name> <output>\n\n", progname);
+    fprintf(stderr, "   -r          Write the audio without a WAVE header\n");
+    fprintf(stderr, "   -t <secs>   Wait this long for waveunwrap to start (default %d)\n", DEFAULT_TIMEOUT);
+    fprintf(stderr, "   -v          Report how soon the first audio arrived\n");
+    fprintf(stderr, "The output may be '-' to write to standard output.\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    uint8_t buffer[READ_BUFFER_SIZE];
+    double start = now(), ready, firstData = 0;
+    int timeout = DEFAULT_TIMEOUT;
+    int rawOutput = 0, verbose = 0;
+    uint64_t total = 0;
+    shmring_t * ring;
+    ssize_t got;
+    int output_fd, opt;
+
+    while ((opt = getopt(argc, argv, "rt:vh")) != -1) {
+        switch (opt) {
+            case 'r':
+                rawOutput = 1;
+                break;
+            case 't':
+                timeout = atoi( optarg );
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind!=2) usage( argv[0] );
+
+    ring = shmring_attach( argv[optind], timeout );
+    if (ring == NULL) {
+        fprintf(stderr, "Error: timed out waiting for '%s'.\n", argv[optind]);
+        exit(2);
+    }
+    ready = now();
+
+    if (strcmp(argv[optind+1], "-")==0) output_fd = STDOUT_FILENO;
+    else output_fd = open( argv[optind+1], O_WRONLY|O_CREAT|O_TRUNC, 0666 );
+    if (output_fd<0) handle_error("unable to open output file");
+
+    if (!rawOutput)
+        write_header( output_fd, ring->header );
+
+    while ((got = shmring_read( ring, buffer, sizeof(buffer) )) > 0) {
+        if (total == 0) firstData = now();
+        write_bytes( output_fd, buffer, got );
+        total += got;
+    }
+    shmring_close( ring );
+
+    if (got < 0) {
+        fprintf(stderr, "Error: waveunwrap failed part way through.\n");
+        exit(2);
+    }
+    if (!rawOutput && (total & 1)) write_bytes( output_fd, "", 1 );
+    if (output_fd != STDOUT_FILENO && close(output_fd)) handle_error("unable to close output file");
+
+    if (verbose) {
+        fprintf(stderr, "Format after %.2f ms, first audio after %.2f ms, %llu bytes in %.2f ms.\n",
+                (ready - start) * 1000, total ? (firstData - start) * 1000 : 0,
+                (unsigned long long)total, (now() - start) * 1000);
+    }
+
+    // Success !
+    return 0;
+}
@@ -23,49 +23,344 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <getopt.h>
+#include <stdatomic.h>
 
 #include "config.h"
 #include "util.h"
+#include "copy.h"
+#include "mpeg.h"
+#include "wave.h"
+#include "split.h"
+#include "follow.h"
+#include "decode.h"
+#include "convert.h"
+#include "shmring.h"
 
 
 // Globals
-#define READ_BUFFER_SIZE 2048
-FILE * output = NULL;
+#define PEEK_BUFFER_SIZE 8192
+copy_params_t copy_params;
+int input_fd = -1;
+int output_fd = -1;
+wave_format_t format;
+int writeXing = 0;
+char * indexname = NULL;
+int splitChannels = 0;
+int rawOutput = 0;
+int followInput = 0;
+int idleTimeout = 0;
+int decodeOutput = 0;
+uint32_t factSamples = 0;
+int haveFact = 0;
+int convertOutput = 0;
+int convertFormat = 0;
+sample_type_t convertType;
+uint32_t convertRate = 0;
+int shmOutput = 0;
+const char * shmName = NULL;
+shmring_t * ring = NULL;
+uint8_t fmtChunk[SHMRING_FMT_SIZE];     // Passed on to a shared memory reader
+uint32_t fmtChunkSize = 0;
+
+// Chunks to copy to split or converted outputs, and where the audio is
+wave_chunk_t * metaChunks = NULL;
+int metaCount = 0;
+uint32_t dataChunkSeek = 0;
+uint32_t dataChunkSize = 0;
+
+
+// Look at the start of the MPEG payload and leave space at the
+// start of the output for a Xing/Info frame.
+// Returns the size of the reserved frame, or 0 if none
+static int
+reserveXingFrame( FILE *input, mpeg_header_t* xing, off_t* xingPos )
+{
+	uint8_t peek[PEEK_BUFFER_SIZE];
+	long dataSeek = ftell( input );
+	size_t peekLen = fread( peek, 1, sizeof(peek), input );
+	mpeg_header_t first;
+	int offset, size;
+
+	if (fseek( input, dataSeek, SEEK_SET )!=0)
+		handle_error( "unable to seek to start of data chunk" );
+
+	offset = mpeg_find_header( peek, peekLen, &first );
+	if (offset < 0) {
+		fprintf(stderr, "Warning: no MPEG Audio frames found; not writing Xing header.\n");
+		return 0;
+	}
+
+	if (first.layer != 3) {
+		fprintf(stderr, "Warning: audio isn't MPEG Layer III; not writing Xing header.\n");
+		return 0;
+	}
+
+	if (mpeg_has_vbr_header( peek+offset, peekLen-offset, &first ))
+		return 0;
+
+	size = mpeg_xing_size( &first, xing );
+	*xingPos = lseek( output_fd, 0, SEEK_CUR );
+	if (size == 0 || size > sizeof(peek) || *xingPos < 0) {
+		fprintf(stderr, "Warning: unable to write Xing header to this output.\n");
+		return 0;
+	}
+
+	// Write a placeholder, which is filled in after the copy
+	memset( peek, 0, size );
+	copy_disable_direct( output_fd );
+	if (write( output_fd, peek, size )!=size)
+		handle_error( "Unable to write bytes to output file." );
+
+	return size;
+}
+
+
+// 'fmt ' 
+void
+proccessFmtChunk( FILE *input, uint32_t chunkSize )
+{
+	long pos = ftell( input );
+
+	// Keep the chunk as it is, so a shared memory reader can write it out
+	fmtChunkSize = chunkSize <= sizeof(fmtChunk) ? chunkSize : 0;
+	if (fmtChunkSize && fread( fmtChunk, fmtChunkSize, 1, input )!=1)
+		handle_error( "unable to read fmt chunk" );
+	if (fseek( input, pos, SEEK_SET )!=0)
+		handle_error( "unable to seek to start of fmt chunk" );
+
+	wave_read_format( input, chunkSize, &format );
+}
+
+
+// 'fact' 
+void
+proccessFactChunk( FILE *input, uint32_t chunkSize )
+{
+	factSamples = read_uint32( input, "fact-sample-count" );
+	haveFact = 1;
+}
+
+
+// Decode G.711 or ADPCM audio to 16-bit linear PCM
+void
+decodeDataChunk( FILE *input, uint32_t chunkSize )
+{
+	wave_format_t pcm;
+	uint64_t frames;
+	decode_t decode;
+
+	if (!decode_supported( &format )) {
+		fprintf(stderr, "Error: unable to decode audio format %d.\n", format.audioFormat);
+		exit(2);
+	}
+
+	frames = decode_frames( &format, chunkSize, factSamples );
+	if (frames * format.channels * 2 > UINT32_MAX)
+		handle_error( "decoded audio is too large for a WAVE file" );
+
+	memset( &pcm, 0, sizeof(pcm) );
+	pcm.audioFormat = WAVE_FORMAT_PCM;
+	pcm.channels = format.channels;
+	pcm.sampleRate = format.sampleRate;
+	pcm.blockAlign = 2 * format.channels;
+	pcm.byteRate = pcm.blockAlign * format.sampleRate;
+	pcm.sampleSize = 16;
+
+	if (!rawOutput)
+		wave_write_header( output_fd, &pcm, frames * pcm.blockAlign, -1, NULL, 0 );
+
+	decode_open( &decode, &format, frames, output_fd );
+	copy_params.sink = decode_feed;
+	copy_params.sink_arg = &decode;
+	copy_range( input_fd, ftell( input ), -1, chunkSize, &copy_params );
+	copy_params.sink = NULL;
+	copy_params.sink_arg = NULL;
+	decode_close( &decode );
+}
+
+
+// Remember a metadata chunk, so that it can be copied to split or converted outputs
+void
+proccessMetaChunk( char* type, uint32_t seek, uint32_t chunkSize )
+{
+	metaChunks = realloc( metaChunks, (metaCount+1) * sizeof(wave_chunk_t) );
+	if (!metaChunks) handle_error( "Unable to allocate memory for chunk list." );
+
+	memcpy( metaChunks[metaCount].type, type, 4 );
+	metaChunks[metaCount].seek = seek;
+	metaChunks[metaCount].size = chunkSize;
+	metaCount++;
+}
+
+
+// Write each channel of the data chunk to its own file
+void
+splitDataChunk( FILE *input, const char* outputname )
+{
+	uint16_t sampleFormat = wave_sample_format( &format );
+	uint32_t length;
+	split_t split;
+
+	if (sampleFormat != WAVE_FORMAT_PCM && sampleFormat != WAVE_FORMAT_FLOAT)
+		handle_error( "can only split channels of PCM audio" );
+	if (format.channels == 0 || format.blockAlign % format.channels)
+		handle_error( "invalid block alignment in fmt chunk" );
+
+	split_open( &split, outputname, &format, dataChunkSize, rawOutput,
+	            fileno( input ), metaChunks, metaCount );
+
+	// Only copy whole frames
+	length = (dataChunkSize / format.blockAlign) * format.blockAlign;
+
+	copy_params.sink = split_feed;
+	copy_params.sink_arg = &split;
+	copy_range( input_fd, dataChunkSeek, -1, length, &copy_params );
+	copy_params.sink = NULL;
+	copy_params.sink_arg = NULL;
+
+	split_close( &split );
+}
+
+
+// Write the data chunk in a different sample format and/or sample rate
+void
+convertDataChunk( FILE *input )
+{
+	wave_format_t out;
+	sample_type_t inType;
+	uint64_t inFrames, outFrames;
+	convert_t conv;
+
+	if (!convert_input_type( &format, &inType ))
+		handle_error( "can only convert PCM audio" );
+
+	// Keep the input sample format, unless asked otherwise
+	if (!convertFormat) {
+		convertType = inType;
+		if (convertType.width == 1) convertType.width = 2;
+	}
+	if (!convertRate) convertRate = format.sampleRate;
+
+	inFrames = dataChunkSize / format.blockAlign;
+	outFrames = convert_out_frames( inFrames, format.sampleRate, convertRate );
+
+	memset( &out, 0, sizeof(out) );
+	out.audioFormat = convertType.isFloat ? WAVE_FORMAT_FLOAT : WAVE_FORMAT_PCM;
+	out.channels = format.channels;
+	out.sampleRate = convertRate;
+	out.blockAlign = convertType.width * format.channels;
+	out.byteRate = out.blockAlign * convertRate;
+	out.sampleSize = convertType.width * 8;
+
+	if (outFrames * out.blockAlign > UINT32_MAX)
+		handle_error( "converted audio is too big for a WAVE file" );
+
+	if (!rawOutput)
+		wave_write_header( output_fd, &out, outFrames * out.blockAlign,
+		                   fileno( input ), metaChunks, metaCount );
+
+	convert_open( &conv, &format, &convertType, convertRate, outFrames, output_fd );
+	copy_params.sink = convert_feed;
+	copy_params.sink_arg = &conv;
+	copy_range( input_fd, dataChunkSeek, -1, inFrames * format.blockAlign, &copy_params );
+	copy_params.sink = NULL;
+	copy_params.sink_arg = NULL;
+	convert_close( &conv );
+
+	// Pad the data chunk to an even length
+	if (!rawOutput && (outFrames * out.blockAlign) & 1)
+		write_bytes( output_fd, "", 1 );
+}
 
 
 // 'data' 
 void
 proccessDataChunk( FILE *input, uint32_t chunkSize )
 {
-	char * read_buffer = malloc( READ_BUFFER_SIZE );
-	int read_size = READ_BUFFER_SIZE;
-	
-	if (!read_buffer)
-		handle_error( "Unable to allocate memory for read buffer.\n" );
-
-	// Copy data from input file to output file
-	// in 2k blocks, until we get to the end of the chunk
-	while( chunkSize ) {
-		if (chunkSize < read_size) read_size = chunkSize;
-		
-		// Read bytes from input file
-		if (fread( read_buffer, read_size, 1, input )!=1)
-			handle_error( "Unable to read from input file.\n" );
-
-		
-		// Write bytes to output file
-		if (fwrite( read_buffer, read_size, 1, output )!=1)
-			handle_error( "Unable to write bytes to output file.\n" );
-		
-		chunkSize -= read_size;
+	uint32_t dataSeek = ftell( input );
+	int isMpeg = (format.audioFormat == WAVE_FORMAT_MPEG ||
+	              format.audioFormat == WAVE_FORMAT_MPEGLAYER3);
+	mpeg_index_t index;
+	mpeg_header_t xing;
+	off_t xingPos = 0;
+	int xingSize = 0;
+
+	if ((writeXing || indexname) && !isMpeg)
+		fprintf(stderr, "Warning: audio isn't MPEG Audio; not building a frame index.\n");
+
+	// Index the MPEG frames as they go past
+	mpeg_index_init( &index );
+	if ((writeXing || indexname) && isMpeg) {
+		copy_params.observer = mpeg_index_feed;
+		copy_params.observer_arg = &index;
+		if (writeXing) xingSize = reserveXingFrame( input, &xing, &xingPos );
 	}
 
-	// Free up the read buffer memory
-	free( read_buffer );
+	if (shmOutput) {
+		// Publish the format, then send a small first block on its own,
+		// so that the player can start without waiting for a full buffer
+		uint32_t first = chunkSize < SHMRING_FIRST_BLOCK ? chunkSize : SHMRING_FIRST_BLOCK;
+
+		if (!ring) ring = shmring_create( shmName, copy_params.depth * copy_params.buffer_size,
+		                                  &format, fmtChunk, fmtChunkSize,
+		                                  haveFact ? &factSamples : NULL,
+		                                  chunkSize, idleTimeout );
+		copy_params.sink = shmring_feed;
+		copy_params.sink_arg = ring;
+		copy_range( input_fd, dataSeek, -1, first, &copy_params );
+		copy_range( input_fd, dataSeek + first, -1, chunkSize - first, &copy_params );
+		copy_params.sink = NULL;
+		copy_params.sink_arg = NULL;
+	} else {
+		// Copy data from input file to output file using
+		// the pipelined copy engine, so that reading and
+		// writing overlap when they are on different devices
+		copy_range( input_fd, dataSeek, output_fd, chunkSize, &copy_params );
+	}
+
+	copy_params.observer = NULL;
+	copy_params.observer_arg = NULL;
+
+	// Fill in the Xing frame, now that we know where all the frames are
+	if (xingSize) {
+		uint8_t frame[PEEK_BUFFER_SIZE];
+		mpeg_xing_build( &index, &xing, frame );
+		copy_disable_direct( output_fd );
+		if (pwrite( output_fd, frame, xingSize, xingPos )!=xingSize)
+			handle_error( "Unable to write Xing frame to output file." );
+	}
+
+	if (indexname && isMpeg) {
+		if (mpeg_write_seek_index( &index, dataSeek, indexname ))
+			handle_error( "Unable to write seek index." );
+	}
+
+	mpeg_index_free( &index );
+}
+
+
+// Let a player reading the ring buffer know that we failed
+// The copy engine's reader thread may exit while the main thread
+// is still writing to the ring, so it is left mapped
+static void
+abortRing( void )
+{
+	if (ring) shmring_abort( ring );
+}
+
+
+static void
+abortRingSignal( int sig )
+{
+	abortRing();
+	signal( sig, SIG_DFL );
+	raise( sig );
 }
 
 
@@ -101,9 +396,23 @@ proccessSubChunk(FILE* file, int seek)
 
     // Check the sub chunk type
     if (memcmp("data", &type, sizeof(type))==0) {
-    	proccessDataChunk( file, chunkSize );
-    } else {
-    	// Ignore all other chunks
+    	if (splitChannels || convertOutput) {
+    		// Wait until all the metadata chunks have been found
+    		dataChunkSeek = seek+8;
+    		dataChunkSize = chunkSize;
+    	} else if (decodeOutput) {
+    		decodeDataChunk( file, chunkSize );
+    	} else {
+    		proccessDataChunk( file, chunkSize );
+    	}
+    } else if (memcmp("fmt ", &type, sizeof(type))==0) {
+    	proccessFmtChunk( file, chunkSize );
+    } else if (memcmp("fact", &type, sizeof(type))==0) {
+    	proccessFactChunk( file, chunkSize );
+    } else if (memcmp("JUNK", &type, sizeof(type))==0) {
+    	// Ignore chunks which don't apply to the output
+    } else if (splitChannels || convertOutput) {
+    	proccessMetaChunk( type, seek+8, chunkSize );
     }
     
     return nextSubChunk;
@@ -151,9 +460,9 @@ proccessChunk(FILE* file, int seek)
         exit(2);
     }
 
-    // Read in the sub chunks
+    // Read in the sub chunks (stopping at the pad byte after odd sized data)
     subSeek = ftell(file);
-    while(subSeek < nextChunk) {
+    while(subSeek + 8 <= nextChunk) {
     
         subSeek = proccessSubChunk( file, subSeek );
     
@@ -167,7 +476,25 @@ proccessChunk(FILE* file, int seek)
 static int usage( const char * progname )
 {
     fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
-    fprintf(stderr, "Usage: %s <input.wav> <output>\n\n", progname);
+    fprintf(stderr, "Usage: %s [options] <input.wav> <output>\n\n", progname);
+    fprintf(stderr, "   -b, --buffer-size <size>  Size of each copy buffer (default %dk)\n", COPY_DEFAULT_BUFFER_SIZE/1024);
+    fprintf(stderr, "   -n, --buffers <count>     Number of copy buffers in flight (default %d)\n", COPY_DEFAULT_DEPTH);
+    fprintf(stderr, "   -D, --direct              Use direct I/O (O_DIRECT), bypassing the page cache\n");
+    fprintf(stderr, "   -x, --xing                Add a Xing/Info header with seek table to MPEG Layer III\n");
+    fprintf(stderr, "   -s, --seek-index <file>   Write an index of seek points within the WAVE file\n");
+    fprintf(stderr, "   -c, --split-channels      Write each channel of PCM audio to a mono file,\n");
+    fprintf(stderr, "                             named <output>-<channel>.wav\n");
+    fprintf(stderr, "   -p, --decode              Decode G.711 or IMA/MS ADPCM audio to 16-bit PCM\n");
+    fprintf(stderr, "   -F, --format <type>       Convert PCM audio to s16, s24, s32 or f32 samples\n");
+    fprintf(stderr, "   -R, --rate <hz>           Resample PCM audio to a different sample rate\n");
+    fprintf(stderr, "   -r, --raw                 Write split, decoded or converted audio without WAVE headers\n");
+    fprintf(stderr, "   -f, --follow              Stream a file that is still being recorded\n");
+    fprintf(stderr, "   -t, --idle-timeout <secs> With --follow, stop if no audio arrives for this long;\n");
+    fprintf(stderr, "                             with --shm, stop if the player reads nothing for this long\n");
+    fprintf(stderr, "                             (without it, --shm waits %d seconds for a player to start)\n", SHMRING_ATTACH_TIMEOUT);
+    fprintf(stderr, "   -m, --shm                 Stream the audio to a player through shared memory,\n");
+    fprintf(stderr, "                             with the output as its name (see waveshmcat)\n");
+    fprintf(stderr, "The output may be '-' to write to standard output.\n\n");
     exit(1);
 }
 
@@ -181,9 +508,73 @@ main(int argc, char **argv)
     char * inputname = NULL;
     char * outputname = NULL;
     int opt;
+    static const struct option longopts[] = {
+        { "buffer-size",    required_argument, NULL, 'b' },
+        { "buffers",        required_argument, NULL, 'n' },
+        { "direct",         no_argument,       NULL, 'D' },
+        { "xing",           no_argument,       NULL, 'x' },
+        { "seek-index",     required_argument, NULL, 's' },
+        { "split-channels", no_argument,       NULL, 'c' },
+        { "decode",         no_argument,       NULL, 'p' },
+        { "format",         required_argument, NULL, 'F' },
+        { "rate",           required_argument, NULL, 'R' },
+        { "raw",            no_argument,       NULL, 'r' },
+        { "follow",         no_argument,       NULL, 'f' },
+        { "idle-timeout",   required_argument, NULL, 't' },
+        { "shm",            no_argument,       NULL, 'm' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
     
-    while ((opt = getopt(argc, argv, "h")) != -1) {
+    copy_params_init( &copy_params );
+
+    while ((opt = getopt_long(argc, argv, "b:n:Dxs:cpF:R:rft:mh", longopts, NULL)) != -1) {
         switch (opt) {
+            case 'b':
+                copy_params.buffer_size = copy_parse_size( optarg );
+                if (copy_params.buffer_size == 0) usage( argv[0] );
+                break;
+            case 'n':
+                copy_params.depth = atoi( optarg );
+                if (copy_params.depth < 1) usage( argv[0] );
+                break;
+            case 'D':
+                copy_params.direct = 1;
+                break;
+            case 'x':
+                writeXing = 1;
+                break;
+            case 's':
+                indexname = optarg;
+                break;
+            case 'c':
+                splitChannels = 1;
+                break;
+            case 'p':
+                decodeOutput = 1;
+                break;
+            case 'F':
+                if (!convert_parse_type( optarg, &convertType )) usage( argv[0] );
+                convertFormat = 1;
+                convertOutput = 1;
+                break;
+            case 'R':
+                convertRate = atoi( optarg );
+                if (convertRate == 0) usage( argv[0] );
+                convertOutput = 1;
+                break;
+            case 'r':
+                rawOutput = 1;
+                break;
+            case 'f':
+                followInput = 1;
+                break;
+            case 't':
+                idleTimeout = atoi( optarg );
+                break;
+            case 'm':
+                shmOutput = 1;
+                break;
             default:
                 fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
             case 'h':
@@ -193,12 +584,38 @@ main(int argc, char **argv)
     }
 
     if (argc-optind!=2) usage( argv[0] );
+    if (followInput && (splitChannels || writeXing || indexname || decodeOutput || convertOutput)) {
+        fprintf(stderr, "Error: --follow can't be used with --split-channels, --decode, --format, --rate, --xing or --seek-index.\n");
+        exit(1);
+    }
+    if (convertOutput && (splitChannels || decodeOutput)) {
+        fprintf(stderr, "Error: --format and --rate can't be used with --split-channels or --decode.\n");
+        exit(1);
+    }
+    if (shmOutput && (followInput || splitChannels || decodeOutput || convertOutput || writeXing)) {
+        fprintf(stderr, "Error: --shm can't be used with --follow, --split-channels, --decode, --format, --rate or --xing.\n");
+        exit(1);
+    }
+    if (splitChannels && decodeOutput) {
+        fprintf(stderr, "Error: --split-channels can't be used with --decode.\n");
+        exit(1);
+    }
     
 
     // Initialise the globals
     inputname = argv[optind];
     outputname = argv[optind+1];
 
+    if (followInput) {
+        output_fd = strcmp(outputname, "-") ? open(outputname, O_WRONLY|O_CREAT|O_TRUNC, 0666) : STDOUT_FILENO;
+        if (output_fd<0) handle_error("unable to open output file");
+
+        follow_data_chunk( inputname, output_fd, idleTimeout );
+
+        if (close(output_fd)) handle_error("unable to close output file");
+        return 0;
+    }
+
     // Get the length of the file
     if(stat(inputname, &fileInfo))   handle_error("unable to stat file");
 
@@ -206,9 +623,23 @@ main(int argc, char **argv)
     input = fopen(inputname, "r");
     if (input==NULL) handle_error("unable to open input file");
 
-    // Open the output file
-    output = fopen(outputname, "w");
-    if (output==NULL) handle_error("unable to open output file");
+    // Open the input again for the copy engine
+    input_fd = copy_open_input(inputname, &copy_params);
+    if (input_fd<0) handle_error("unable to open input file");
+
+    // Open the output file (split outputs are opened later)
+    if (shmOutput) {
+        // The ring buffer is created once the format is known
+        shmName = outputname;
+        atexit( abortRing );
+        signal( SIGINT, abortRingSignal );
+        signal( SIGTERM, abortRingSignal );
+    } else if (!splitChannels && strcmp(outputname, "-")==0) {
+        output_fd = STDOUT_FILENO;
+    } else if (!splitChannels) {
+        output_fd = copy_open_output(outputname, &copy_params);
+        if (output_fd<0) handle_error("unable to open output file");
+    }
 
 
     // Get chunks until the next chunk is
@@ -216,10 +647,24 @@ main(int argc, char **argv)
     while (seek < fileInfo.st_size) {
         seek = proccessChunk( input, seek );
     }
+
+    if (shmOutput) {
+        if (ring == NULL) handle_error("no data chunk found");
+        shmring_finish( ring, SHMRING_END );
+        ring = NULL;
+    } else if (splitChannels) {
+        if (dataChunkSeek == 0) handle_error("no data chunk found");
+        splitDataChunk( input, outputname );
+    } else if (convertOutput) {
+        if (dataChunkSeek == 0) handle_error("no data chunk found");
+        convertDataChunk( input );
+    }
     
     // Close the file
     fclose(input);
-    fclose(output);
+    close(input_fd);
+    copy_params_free( &copy_params );
+    if (output_fd>=0 && close(output_fd)) handle_error("unable to close output file");
     
     // Success !
     return 0;
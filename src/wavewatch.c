@@ -0,0 +1,819 @@
+/*
+    wavewatch.c
+    Watch a folder for new WAVE files and convert each of them once
+
+    New files are picked up with inotify as soon as they are closed
+    after writing (or moved into the folder), and converted by running
+    a command (bsiwave_to_mpeg by default) on a bounded pool of workers.
+    A journal in the output folder records what has been converted, so
+    that unchanged files are skipped and an interrupted run carries on
+    where it left off.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "util.h"
+#include "hash.h"
+
+
+#define JOURNAL_HEADER      "wavewatch-journal 1"
+#define JOURNAL_NAME        ".wavewatch-journal"
+#define DEFAULT_COMMAND     "bsiwave_to_mpeg"
+#define DEFAULT_SUFFIX      ".mp3"
+#define DEFAULT_WORKERS     2
+#define DEFAULT_QUEUE       64
+#define HASH_BUFFER_SIZE    (1024*1024)
+
+// Journal entry states
+#define ENTRY_PENDING       0       // Started, but not finished
+#define ENTRY_DONE          1
+#define ENTRY_FAILED        2       // Don't retry until the file changes
+
+
+typedef struct {
+    char *   name;          // File name within the input folder
+    time_t   mtime;
+    off_t    size;
+    uint64_t hash;          // Hash of the data chunk payload (-H only)
+    int      state;
+} journal_entry_t;
+
+
+// Globals
+int debug = 0;
+int workers = DEFAULT_WORKERS;
+int queueLimit = DEFAULT_QUEUE;
+int useHash = 0;
+int runOnce = 0;
+int rescanInterval = 0;
+int failures = 0;
+const char * command = DEFAULT_COMMAND;
+const char * suffix = DEFAULT_SUFFIX;
+const char * inputDir = NULL;
+const char * outputDir = NULL;
+volatile sig_atomic_t stopping = 0;
+sigset_t stopSignals;               // Taken by signal_thread
+int stopPipe[2] = { -1, -1 };       // Wakes the watcher when stopping
+
+// The journal, sorted by name
+pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+journal_entry_t * journal = NULL;
+size_t journalCount = 0;
+size_t journalAlloc = 0;
+FILE * journalFile = NULL;
+
+// Files waiting for a worker, and the files being converted
+pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queueNotEmpty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t queueNotFull = PTHREAD_COND_INITIALIZER;
+char ** queue = NULL;
+int queueHead = 0;
+int queueLen = 0;
+char ** active = NULL;
+int * activeAgain = NULL;
+int queueClosed = 0;
+
+
+
+static char*
+join_path( const char* dir, const char* prefix, const char* name, const char* ext )
+{
+    char * path = malloc( strlen(dir) + strlen(prefix) + strlen(name) + strlen(ext) + 2 );
+    if (!path) handle_error("unable to allocate memory for path");
+    sprintf( path, "%s/%s%s%s", dir, prefix, name, ext );
+    return path;
+}
+
+
+static int
+is_wave_name( const char* name )
+{
+    size_t len = strlen( name );
+    return name[0] != '.' && len > 4 && strcasecmp( name + len - 4, ".wav" ) == 0;
+}
+
+
+// Name of the output file for an input file
+static char*
+output_name( const char* name )
+{
+    char * base = strdup( name );
+    char * result;
+
+    if (!base) handle_error("unable to allocate memory for path");
+    base[ strlen(base) - 4 ] = 0;
+    result = join_path( outputDir, "", base, suffix );
+    free( base );
+    return result;
+}
+
+
+
+/* ---- Journal ---- */
+
+static int
+compare_entry( const void* a, const void* b )
+{
+    return strcmp( ((const journal_entry_t*)a)->name, ((const journal_entry_t*)b)->name );
+}
+
+
+// Find the entry for a file, adding one if create is set
+static journal_entry_t*
+journal_find( const char* name, int create )
+{
+    journal_entry_t key;
+    size_t lo = 0, hi = journalCount;
+
+    key.name = (char*)name;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = compare_entry( &key, &journal[mid] );
+        if (cmp == 0) return &journal[mid];
+        if (cmp < 0) hi = mid; else lo = mid + 1;
+    }
+
+    if (!create) return NULL;
+
+    if (journalCount == journalAlloc) {
+        journalAlloc = journalAlloc ? journalAlloc*2 : 1024;
+        journal = realloc( journal, journalAlloc * sizeof(journal_entry_t) );
+        if (!journal) handle_error("unable to allocate memory for journal");
+    }
+    memmove( &journal[lo+1], &journal[lo], (journalCount - lo) * sizeof(journal_entry_t) );
+    journalCount++;
+
+    memset( &journal[lo], 0, sizeof(journal_entry_t) );
+    journal[lo].name = strdup( name );
+    journal[lo].state = ENTRY_PENDING;
+    if (!journal[lo].name) handle_error("unable to allocate memory for journal");
+
+    return &journal[lo];
+}
+
+
+// Replay the journal of a previous run
+static void
+load_journal( const char* filename )
+{
+    char line[8192];
+    FILE* file = fopen( filename, "r" );
+
+    // It is fine for the journal not to exist yet
+    if (file == NULL) return;
+
+    if (fgets(line, sizeof(line), file) == NULL ||
+        strncmp(line, JOURNAL_HEADER, strlen(JOURNAL_HEADER)) != 0) {
+        fprintf(stderr, "Warning: ignoring invalid journal '%s'.\n", filename);
+        fclose( file );
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        long long mtime, size;
+        unsigned long long hash;
+        int state, nameStart = 0;
+
+        // A line cut short by a crash is ignored
+        if (line[ strcspn(line, "\n") ] != '\n') break;
+        line[ strcspn(line, "\n") ] = 0;
+
+        if (strncmp(line, "start ", 6) == 0) {
+            journal_find( line + 6, 1 )->state = ENTRY_PENDING;
+        } else if (sscanf(line, "done %lld %lld %llx %d %n",
+                          &mtime, &size, &hash, &state, &nameStart) >= 4 && nameStart) {
+            journal_entry_t* entry = journal_find( line + nameStart, 1 );
+            entry->mtime = mtime;
+            entry->size = size;
+            entry->hash = hash;
+            entry->state = state;
+        }
+    }
+
+    fclose( file );
+}
+
+
+static void
+write_done( FILE* file, const journal_entry_t* entry )
+{
+    fprintf( file, "done %lld %lld %016llx %d %s\n",
+             (long long)entry->mtime, (long long)entry->size,
+             (unsigned long long)entry->hash, entry->state, entry->name );
+}
+
+
+// Rewrite the journal with one line per finished file, and
+// leave it open for appending
+static void
+compact_journal( const char* filename )
+{
+    char * tmpname = malloc( strlen(filename) + 5 );
+    FILE * file = NULL;
+    size_t n;
+
+    if (!tmpname) handle_error("unable to allocate memory for journal");
+    sprintf( tmpname, "%s.tmp", filename );
+
+    file = fopen( tmpname, "w" );
+    if (file == NULL) handle_error("unable to open journal for writing");
+
+    fprintf( file, "%s\n", JOURNAL_HEADER );
+    for (n=0; n<journalCount; n++) {
+        if (journal[n].state != ENTRY_PENDING)
+            write_done( file, &journal[n] );
+    }
+
+    if (fflush( file ) || fsync( fileno(file) ) || fclose( file ) || rename( tmpname, filename ))
+        handle_error("unable to write journal");
+    free( tmpname );
+
+    journalFile = fopen( filename, "a" );
+    if (journalFile == NULL) handle_error("unable to open journal for writing");
+}
+
+
+// Append a line to the journal, and make sure it reaches the disk
+static void
+journal_append( const journal_entry_t* entry )
+{
+    if (entry->state == ENTRY_PENDING)
+        fprintf( journalFile, "start %s\n", entry->name );
+    else
+        write_done( journalFile, entry );
+
+    if (fflush( journalFile ) || fdatasync( fileno(journalFile) ))
+        handle_error("unable to write journal");
+}
+
+
+static void
+journal_record( const char* name, const struct stat* st, uint64_t hash, int state )
+{
+    journal_entry_t* entry;
+
+    pthread_mutex_lock( &journalLock );
+    entry = journal_find( name, 1 );
+    if (st) {
+        entry->mtime = st->st_mtime;
+        entry->size = st->st_size;
+    }
+    entry->hash = hash;
+    entry->state = state;
+    journal_append( entry );
+    pthread_mutex_unlock( &journalLock );
+}
+
+
+// Check the journal, and the output file, to see if a file needs converting
+// Returns 1 if it is up to date, and sets *entry to what is known about it
+static int
+is_up_to_date( const char* name, const struct stat* st, journal_entry_t* entry )
+{
+    char * outpath = output_name( name );
+    struct stat out;
+    int haveOutput = (stat( outpath, &out ) == 0);
+    journal_entry_t* found;
+
+    free( outpath );
+
+    pthread_mutex_lock( &journalLock );
+    found = journal_find( name, 0 );
+    if (found) *entry = *found;
+    else memset( entry, 0, sizeof(journal_entry_t) );
+    pthread_mutex_unlock( &journalLock );
+
+    if (found && entry->state != ENTRY_PENDING &&
+        entry->mtime == st->st_mtime && entry->size == st->st_size)
+        return haveOutput || entry->state == ENTRY_FAILED;
+
+    // The converter gives outputs the modification time of their input,
+    // so outputs made before the journal existed are recognised too
+    if (!found && haveOutput && out.st_mtime == st->st_mtime && out.st_size > 0)
+        return 1;
+
+    return 0;
+}
+
+
+
+/* ---- Conversion ---- */
+
+// Hash the audio in a WAVE file, so that a file which has been
+// copied in again without changing can be recognised
+static uint64_t
+data_hash( const char* path )
+{
+    hash_state_t state;
+    uint32_t dataSeek, dataSize;
+    uint8_t * buffer = NULL;
+    FILE * file = fopen( path, "r" );
+    int fd;
+
+    if (file == NULL) return 0;
+    if (find_data_chunk( file, &dataSeek, &dataSize )) {
+        fclose( file );
+        return 0;
+    }
+
+    buffer = malloc( HASH_BUFFER_SIZE );
+    if (!buffer) handle_error("unable to allocate memory for read buffer");
+
+    fd = fileno( file );
+    hash_init( &state );
+    while (dataSize) {
+        size_t want = dataSize < HASH_BUFFER_SIZE ? dataSize : HASH_BUFFER_SIZE;
+        ssize_t res = pread( fd, buffer, want, dataSeek );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        hash_update( &state, buffer, res );
+        dataSeek += res;
+        dataSize -= res;
+    }
+
+    free( buffer );
+    fclose( file );
+
+    // A truncated payload can't be matched
+    return dataSize ? 0 : hash_digest( &state );
+}
+
+
+// Run the conversion command; returns its exit status, or -1 if
+// it couldn't be run or was killed by a signal
+static int
+run_command( const char* inpath, const char* outpath )
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("Warning: unable to start conversion");
+        return -1;
+    } else if (pid == 0) {
+        sigprocmask( SIG_UNBLOCK, &stopSignals, NULL );
+        execlp( command, command, inpath, outpath, (char*)NULL );
+        fprintf(stderr, "Error: unable to run '%s': %s\n", command, strerror(errno));
+        _exit(127);
+    }
+
+    while (waitpid( pid, &status, 0 ) < 0) {
+        if (errno != EINTR) return -1;
+    }
+
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+
+static void
+convert_file( const char* name )
+{
+    char * inpath = join_path( inputDir, "", name, "" );
+    char * outpath = output_name( name );
+    char * tmppath = join_path( outputDir, ".", strrchr(outpath, '/') + 1, ".part" );
+    struct stat before, after, out;
+    journal_entry_t entry;
+    uint64_t hash = 0;
+    int state, res;
+
+    // The file may have been removed since it was queued
+    if (stat( inpath, &before ) || !S_ISREG(before.st_mode)) goto done;
+    if (is_up_to_date( name, &before, &entry )) goto done;
+
+    // Contents unchanged, even though the file has been touched or copied again
+    if (useHash) {
+        hash = data_hash( inpath );
+        if (hash && entry.hash == hash && entry.state != ENTRY_PENDING &&
+            (stat( outpath, &out ) == 0 || entry.state == ENTRY_FAILED)) {
+            if (debug) fprintf(stderr, "Unchanged: %s\n", inpath);
+            journal_record( name, &before, hash, entry.state );
+            goto done;
+        }
+    }
+
+    // Convert to a hidden file, so that a half written output never appears
+    journal_record( name, NULL, hash, ENTRY_PENDING );
+    unlink( tmppath );
+    res = run_command( inpath, tmppath );
+
+    // Interrupted, rather than failed; leave it pending so it is tried again
+    if (res < 0 || (res != 0 && stopping)) {
+        if (debug) fprintf(stderr, "Interrupted: %s\n", inpath);
+        unlink( tmppath );
+        goto done;
+    }
+
+    // Written to while being converted; it will be queued again once closed
+    if (stat( inpath, &after ) || after.st_mtime != before.st_mtime ||
+        after.st_size != before.st_size) {
+        if (debug) fprintf(stderr, "Changed during conversion: %s\n", inpath);
+        unlink( tmppath );
+        goto done;
+    }
+
+    if (res == 0 && stat( tmppath, &out ) == 0 && rename( tmppath, outpath ) == 0) {
+        printf("%s -> %s\n", inpath, outpath);
+        fflush(stdout);
+        state = ENTRY_DONE;
+    } else {
+        fprintf(stderr, "Warning: failed to convert '%s'.\n", inpath);
+        unlink( tmppath );
+        state = ENTRY_FAILED;
+        pthread_mutex_lock( &queueLock );
+        failures++;
+        pthread_mutex_unlock( &queueLock );
+    }
+
+    journal_record( name, &before, hash, state );
+
+done:
+    free( tmppath );
+    free( outpath );
+    free( inpath );
+}
+
+
+
+/* ---- Work queue ---- */
+
+// Is a file already waiting for a worker?
+static int
+is_waiting( const char* name )
+{
+    int n;
+
+    for (n=0; n<queueLen; n++) {
+        if (strcmp( queue[ (queueHead + n) % queueLimit ], name ) == 0) return 1;
+    }
+    return 0;
+}
+
+
+// Add a file to the queue, waiting for space if it is full
+static void
+enqueue_file( const char* name )
+{
+    char * copy = NULL;
+    int n;
+
+    pthread_mutex_lock( &queueLock );
+
+    for (;;) {
+        if (stopping || is_waiting( name )) goto done;
+
+        // A file being converted may have changed since it was started,
+        // so have the same worker look at it again afterwards
+        for (n=0; n<workers; n++) {
+            if (active[n] && strcmp( active[n], name ) == 0) {
+                activeAgain[n] = 1;
+                goto done;
+            }
+        }
+
+        if (queueLen < queueLimit) break;
+        pthread_cond_wait( &queueNotFull, &queueLock );
+    }
+
+    copy = strdup( name );
+    if (!copy) handle_error("unable to allocate memory for queue");
+    queue[ (queueHead + queueLen) % queueLimit ] = copy;
+    queueLen++;
+    pthread_cond_signal( &queueNotEmpty );
+
+done:
+    pthread_mutex_unlock( &queueLock );
+}
+
+
+static void*
+worker_thread( void* arg )
+{
+    int slot = (int)(intptr_t)arg;
+
+    for (;;) {
+        char * name;
+        int again;
+
+        pthread_mutex_lock( &queueLock );
+        while (queueLen == 0 && !queueClosed)
+            pthread_cond_wait( &queueNotEmpty, &queueLock );
+        if (queueLen == 0) {
+            pthread_mutex_unlock( &queueLock );
+            break;
+        }
+        name = queue[ queueHead ];
+        queueHead = (queueHead + 1) % queueLimit;
+        queueLen--;
+        active[slot] = name;
+        pthread_cond_signal( &queueNotFull );
+        pthread_mutex_unlock( &queueLock );
+
+        do {
+            convert_file( name );
+
+            pthread_mutex_lock( &queueLock );
+            again = activeAgain[slot] && !stopping;
+            activeAgain[slot] = 0;
+            if (!again) active[slot] = NULL;
+            pthread_mutex_unlock( &queueLock );
+        } while (again);
+
+        free( name );
+    }
+
+    return NULL;
+}
+
+
+// Queue every file in the input folder that isn't up to date
+static void
+scan_folder()
+{
+    DIR * dir = opendir( inputDir );
+    struct dirent * ent;
+
+    if (dir == NULL) handle_error("unable to open input folder");
+
+    while ((ent = readdir( dir )) != NULL && !stopping) {
+        char * path;
+        struct stat st;
+        journal_entry_t entry;
+
+        if (!is_wave_name( ent->d_name )) continue;
+
+        path = join_path( inputDir, "", ent->d_name, "" );
+        if (stat( path, &st ) == 0 && S_ISREG(st.st_mode) &&
+            !is_up_to_date( ent->d_name, &st, &entry ))
+            enqueue_file( ent->d_name );
+        free( path );
+    }
+
+    closedir( dir );
+}
+
+
+// Wait for SIGINT or SIGTERM, then tell the other threads to stop.
+// A signal handler can't wake a thread waiting for space in the queue,
+// so the signals are blocked everywhere else and taken here instead
+static void*
+signal_thread( void* arg )
+{
+    int sig;
+
+    while (sigwait( &stopSignals, &sig ) != 0);
+
+    pthread_mutex_lock( &queueLock );
+    stopping = 1;
+    pthread_cond_broadcast( &queueNotFull );
+    pthread_mutex_unlock( &queueLock );
+
+    if (write( stopPipe[1], "", 1 ) < 0)
+        perror("Warning: unable to wake watcher");
+    return NULL;
+}
+
+
+// Wait for files to be written or moved into the input folder
+static void
+watch_folder()
+{
+    int fd = -1;
+    int timeout = rescanInterval ? rescanInterval*1000 : -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    fd = inotify_init();
+    if (fd < 0 || inotify_add_watch( fd, inputDir, IN_CLOSE_WRITE | IN_MOVED_TO ) < 0)
+        handle_error("unable to watch input folder");
+#else
+    if (!rescanInterval) timeout = 10*1000;
+#endif
+
+    // Look at what is already there, now that nothing new can be missed
+    scan_folder();
+
+    while (!stopping) {
+        struct pollfd pfd[2];
+        int res;
+
+        // A negative fd (no inotify) is ignored
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = stopPipe[0];
+        pfd[1].events = POLLIN;
+        res = poll( pfd, 2, timeout );
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) handle_error("unable to wait for changes");
+        if (pfd[1].revents) continue;
+
+        if (res == 0) {
+            // Catch anything inotify can't see, such as files on network shares
+            scan_folder();
+            continue;
+        }
+
+#ifdef HAVE_SYS_INOTIFY_H
+        {
+            char buf[64*1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t len = read( fd, buf, sizeof(buf) );
+            char * p;
+
+            if (len < 0 && errno == EINTR) continue;
+            if (len <= 0) handle_error("unable to read changes to input folder");
+
+            for (p = buf; p < buf + len; ) {
+                struct inotify_event* ev = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    // Events were lost, so look at everything again
+                    scan_folder();
+                } else if (ev->len && is_wave_name( ev->name )) {
+                    if (debug) fprintf(stderr, "Changed: %s\n", ev->name);
+                    enqueue_file( ev->name );
+                }
+            }
+        }
+#endif
+    }
+
+    if (fd >= 0) close( fd );
+}
+
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <input folder> <output folder>\n\n", progname);
+    fprintf(stderr, "   -1          Convert what is in the input folder, then exit\n");
+    fprintf(stderr, "   -e <cmd>    Conversion command, run as <cmd> <input> <output> (default %s)\n", DEFAULT_COMMAND);
+    fprintf(stderr, "   -s <suffix> Suffix of output files (default %s)\n", DEFAULT_SUFFIX);
+    fprintf(stderr, "   -j <count>  Number of conversions to run at once (default %d)\n", DEFAULT_WORKERS);
+    fprintf(stderr, "   -q <count>  Number of files that may wait for a worker (default %d)\n", DEFAULT_QUEUE);
+    fprintf(stderr, "   -J <file>   Journal file (default <output folder>/%s)\n", JOURNAL_NAME);
+    fprintf(stderr, "   -H          Skip files whose audio is unchanged, even if the file is newer\n");
+    fprintf(stderr, "   -i <secs>   Also rescan the input folder this often\n");
+    fprintf(stderr, "   -d          Display debugging information\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char * journalname = NULL;
+    pthread_t * pool = NULL;
+    pthread_t stopper;
+    struct stat st;
+    int n, opt;
+
+    while ((opt = getopt(argc, argv, "1e:s:j:q:J:Hi:dh")) != -1) {
+        switch (opt) {
+            case '1':
+                runOnce = 1;
+                break;
+            case 'e':
+                command = optarg;
+                break;
+            case 's':
+                suffix = optarg;
+                break;
+            case 'j':
+                workers = atoi( optarg );
+                if (workers < 1) usage( argv[0] );
+                break;
+            case 'q':
+                queueLimit = atoi( optarg );
+                if (queueLimit < 1) usage( argv[0] );
+                break;
+            case 'J':
+                journalname = optarg;
+                break;
+            case 'H':
+                useHash = 1;
+                break;
+            case 'i':
+                rescanInterval = atoi( optarg );
+                break;
+            case 'd':
+                debug = 1;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind!=2) usage( argv[0] );
+    inputDir = argv[optind];
+    outputDir = argv[optind+1];
+
+    if (stat(inputDir, &st) || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: input must be a folder.\n");
+        exit(1);
+    }
+    if (stat(outputDir, &st) || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: output must be a folder.\n");
+        exit(1);
+    }
+
+    // Carry on from where the last run got to
+    if (!journalname) journalname = join_path( outputDir, "", JOURNAL_NAME, "" );
+    load_journal( journalname );
+    compact_journal( journalname );
+
+    // Stop cleanly, finishing the conversions in progress; the
+    // threads started from here on inherit the blocked signals
+    sigemptyset( &stopSignals );
+    sigaddset( &stopSignals, SIGINT );
+    sigaddset( &stopSignals, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+    if (pipe( stopPipe )) handle_error("unable to create pipe");
+    if (pthread_create( &stopper, NULL, signal_thread, NULL ) || pthread_detach( stopper ))
+        handle_error("unable to start signal thread");
+
+    queue = calloc( queueLimit, sizeof(char*) );
+    active = calloc( workers, sizeof(char*) );
+    activeAgain = calloc( workers, sizeof(int) );
+    pool = calloc( workers, sizeof(pthread_t) );
+    if (!queue || !active || !activeAgain || !pool) handle_error("unable to allocate memory for work queue");
+
+    for (n=0; n<workers; n++) {
+        if (pthread_create( &pool[n], NULL, worker_thread, (void*)(intptr_t)n ))
+            handle_error("unable to start worker thread");
+    }
+
+    if (runOnce) scan_folder();
+    else watch_folder();
+
+    // Let the workers finish what is queued
+    pthread_mutex_lock( &queueLock );
+    queueClosed = 1;
+    if (stopping) {
+        // Files still waiting will be found by the next run
+        while (queueLen) {
+            free( queue[ queueHead ] );
+            queueHead = (queueHead + 1) % queueLimit;
+            queueLen--;
+        }
+    }
+    pthread_cond_broadcast( &queueNotEmpty );
+    pthread_mutex_unlock( &queueLock );
+
+    for (n=0; n<workers; n++) {
+        pthread_join( pool[n], NULL );
+    }
+
+    fclose( journalFile );
+    free( pool );
+    free( activeAgain );
+    free( active );
+    free( queue );
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,678 @@
+/*
+    wavewrap.c
+    Wrap MPEG Audio or raw PCM in a Broadcast WAVE file
+
+    The opposite of waveunwrap: space for the header is written first,
+    the audio is streamed into the data chunk while its MPEG frames are
+    counted, and then the header is written again with the sizes, the
+    fact sample count and the mext frame information filled in.
+    Metadata for the bext, cart, LIST and DISP chunks is read from a
+    file in the same 'key: value' format that wavemetainfo writes.
+
+    Copyright (C) 2005  Nicholas J. Humfrey
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "config.h"
+#include "util.h"
+#include "mpeg.h"
+#include "wave.h"
+#include "arena.h"
+#include "meta.h"
+#include "id3.h"
+
+
+#define STREAM_BUFFER_SIZE  (1024*1024)
+#define PEEK_BUFFER_SIZE    (64*1024)
+#define ID3V1_SIZE          128
+#define BEXT_SIZE           602
+#define CART_SIZE           2048
+#define MEXT_SIZE           12
+
+// fmt chunk values for MPEG Audio (from mmreg.h)
+#define ACM_MPEG_LAYER1         0x0001
+#define ACM_MPEG_LAYER2         0x0002
+#define ACM_MPEG_LAYER3         0x0004
+#define ACM_MPEG_PRIVATEBIT     0x0001
+#define ACM_MPEG_COPYRIGHT      0x0002
+#define ACM_MPEG_ORIGINALHOME   0x0004
+#define ACM_MPEG_PROTECTIONBIT  0x0008
+#define ACM_MPEG_ID_MPEG1       0x0010
+#define MPEGLAYER3_ID_MPEG      1
+
+// mext sound information bits
+#define MEXT_HOMOGENEOUS        0x0001
+#define MEXT_NO_PADDING         0x0002
+#define MEXT_NO_PADDING_44K     0x0004
+
+
+// Globals
+int input_fd = -1;
+int output_fd = -1;
+int isMpeg = 1;
+wave_format_t pcmFormat;
+mpeg_index_t mpegIndex;
+uint64_t dataSize = 0;
+meta_info_t meta;
+uint8_t * header = NULL;
+size_t headerSize = 0;
+
+
+
+// Copy a metadata value into a fixed size field, which isn't
+// necessarily NUL terminated
+static uint8_t*
+put_text( uint8_t* p, const char* key, size_t size )
+{
+    const char* value = meta_get( &meta, key );
+    size_t len = value ? strlen(value) : 0;
+
+    memset( p, 0, size );
+    if (len > size) len = size;
+    if (len) memcpy( p, value, len );
+    return p + size;
+}
+
+
+static uint8_t*
+put_padding( uint8_t* p, size_t len )
+{
+    if (len & 1) *p++ = 0;
+    return p;
+}
+
+
+static int
+has_keys( const char* prefix )
+{
+    int n;
+    for (n=0; n<meta.count; n++) {
+        if (strncmp( meta.items[n].key, prefix, strlen(prefix) )==0) return 1;
+    }
+    return 0;
+}
+
+
+static uint8_t*
+put_fmt_chunk( uint8_t* p )
+{
+    const mpeg_header_t* first = &mpegIndex.first;
+    uint32_t samples = mpegIndex.frames * first->samples;
+    uint32_t byteRate, blockAlign, bitrate;
+    uint16_t flags = 0, mode;
+
+    if (!isMpeg) {
+        p = wave_put_chunk_header( p, "fmt ", 16 );
+        p = wave_put_uint16( p, WAVE_FORMAT_PCM );
+        p = wave_put_uint16( p, pcmFormat.channels );
+        p = wave_put_uint32( p, pcmFormat.sampleRate );
+        p = wave_put_uint32( p, pcmFormat.byteRate );
+        p = wave_put_uint16( p, pcmFormat.blockAlign );
+        return wave_put_uint16( p, pcmFormat.sampleSize );
+    }
+
+    // Constant bitrate streams without padding have a fixed block size
+    if (mpegIndex.vbr) {
+        bitrate = 0;
+        byteRate = samples ? dataSize * first->samplerate / samples : 0;
+        blockAlign = 1;
+    } else {
+        bitrate = first->bitrate * 1000;
+        byteRate = bitrate / 8;
+        blockAlign = mpegIndex.padded ? 1 : first->frame_size;
+    }
+
+    if (first->layer == 3) {
+        p = wave_put_chunk_header( p, "fmt ", 30 );
+        p = wave_put_uint16( p, WAVE_FORMAT_MPEGLAYER3 );
+    } else {
+        p = wave_put_chunk_header( p, "fmt ", 40 );
+        p = wave_put_uint16( p, WAVE_FORMAT_MPEG );
+    }
+    p = wave_put_uint16( p, first->mode == 3 ? 1 : 2 );
+    p = wave_put_uint32( p, first->samplerate );
+    p = wave_put_uint32( p, byteRate );
+    p = wave_put_uint16( p, blockAlign );
+    p = wave_put_uint16( p, 0 );
+
+    if (first->layer == 3) {
+        p = wave_put_uint16( p, 12 );
+        p = wave_put_uint16( p, MPEGLAYER3_ID_MPEG );
+        p = wave_put_uint32( p, 0 );
+        p = wave_put_uint16( p, first->frame_size - first->padding );
+        p = wave_put_uint16( p, 1 );
+        return wave_put_uint16( p, 0 );
+    }
+
+    if (first->raw[2] & 0x01) flags |= ACM_MPEG_PRIVATEBIT;
+    if (first->raw[3] & 0x08) flags |= ACM_MPEG_COPYRIGHT;
+    if (first->raw[3] & 0x04) flags |= ACM_MPEG_ORIGINALHOME;
+    if (!(first->raw[1] & 0x01)) flags |= ACM_MPEG_PROTECTIONBIT;
+    if (first->version == 1) flags |= ACM_MPEG_ID_MPEG1;
+    mode = 1 << first->mode;
+
+    p = wave_put_uint16( p, 22 );
+    p = wave_put_uint16( p, first->layer == 1 ? ACM_MPEG_LAYER1 : ACM_MPEG_LAYER2 );
+    p = wave_put_uint32( p, bitrate );
+    p = wave_put_uint16( p, mode );
+    p = wave_put_uint16( p, first->mode == 1 ? 1 << ((first->raw[3] >> 4) & 3) : 0 );
+    p = wave_put_uint16( p, (first->raw[3] & 3) + 1 );
+    p = wave_put_uint16( p, flags );
+    p = wave_put_uint32( p, 0 );
+    return wave_put_uint32( p, 0 );
+}
+
+
+static uint8_t*
+put_mpeg_chunks( uint8_t* p )
+{
+    const mpeg_header_t* first = &mpegIndex.first;
+    uint16_t info = 0;
+    uint16_t frameSize = 0;
+
+    if (!mpegIndex.vbr && mpegIndex.resyncs == 0) {
+        info |= MEXT_HOMOGENEOUS;
+        frameSize = first->frame_size - first->padding;
+    }
+    if (mpegIndex.padded == 0) {
+        info |= MEXT_NO_PADDING;
+        if (first->samplerate == 44100 || first->samplerate == 22050)
+            info |= MEXT_NO_PADDING_44K;
+    }
+
+    p = wave_put_chunk_header( p, "fact", 4 );
+    p = wave_put_uint32( p, mpegIndex.frames * first->samples );
+
+    p = wave_put_chunk_header( p, "mext", MEXT_SIZE );
+    p = wave_put_uint16( p, info );
+    p = wave_put_uint16( p, frameSize );
+    p = wave_put_uint16( p, 0 );        // No ancillary data
+    p = wave_put_uint16( p, 0 );
+    return wave_put_uint32( p, 0 );
+}
+
+
+static uint8_t*
+put_bext_chunk( uint8_t* p )
+{
+    const char* history = meta_get( &meta, "bext-coding-history" );
+    const char* timeRef = meta_get( &meta, "bext-time-reference" );
+    uint64_t samples = timeRef ? strtoull( timeRef, NULL, 10 ) : 0;
+    size_t historyLen = history ? strlen(history) : 0;
+
+    p = wave_put_chunk_header( p, "bext", BEXT_SIZE + historyLen );
+    p = put_text( p, "bext-description", 256 );
+    p = put_text( p, "bext-originator", 32 );
+    p = put_text( p, "bext-originator-ref", 32 );
+    p = put_text( p, "bext-origination-date", 10 );
+    p = put_text( p, "bext-origination-time", 8 );
+    p = wave_put_uint32( p, samples );
+    p = wave_put_uint32( p, samples >> 32 );
+    p = wave_put_uint16( p, 1 );        // Version
+    memset( p, 0, 64 + 190 );           // UMID and reserved
+    p += 64 + 190;
+    if (historyLen) {
+        memcpy( p, history, historyLen );
+        p += historyLen;
+    }
+    return put_padding( p, historyLen );
+}
+
+
+static uint8_t*
+put_cart_chunk( uint8_t* p )
+{
+    const char* level = meta_get( &meta, "cart-levelreference" );
+    const char* tagText = meta_get( &meta, "cart-tagtext" );
+    size_t tagLen = tagText ? strlen(tagText) : 0;
+    int n, timers = 0;
+
+    p = wave_put_chunk_header( p, "cart", CART_SIZE + tagLen );
+    if (meta_get( &meta, "cart-version" )) p = put_text( p, "cart-version", 4 );
+    else { memcpy( p, "0101", 4 ); p += 4; }
+    p = put_text( p, "cart-title", 64 );
+    p = put_text( p, "cart-artist", 64 );
+    p = put_text( p, "cart-cutid", 64 );
+    p = put_text( p, "cart-clientid", 64 );
+    p = put_text( p, "cart-category", 64 );
+    p = put_text( p, "cart-classification", 64 );
+    p = put_text( p, "cart-outcue", 64 );
+    p = put_text( p, "cart-startdate", 10 );
+    p = put_text( p, "cart-starttime", 8 );
+    p = put_text( p, "cart-enddate", 10 );
+    p = put_text( p, "cart-endtime", 8 );
+    p = put_text( p, "cart-producerappid", 64 );
+    p = put_text( p, "cart-producerappversion", 64 );
+    p = put_text( p, "cart-userdef", 64 );
+    p = wave_put_uint32( p, level ? strtol( level, NULL, 10 ) : 0 );
+
+    // Post timers, written by wavemetainfo as 'cart-timer-<usage>: <value>'
+    for (n=0; n<meta.count && timers<8; n++) {
+        const char* usage = meta.items[n].key + 11;
+        if (strncmp( meta.items[n].key, "cart-timer-", 11 )!=0 || !*usage) continue;
+        memset( p, ' ', 4 );
+        memcpy( p, usage, strlen(usage) < 4 ? strlen(usage) : 4 );
+        p = wave_put_uint32( p+4, strtoul( meta.items[n].value, NULL, 10 ) );
+        timers++;
+    }
+    memset( p, 0, (8 - timers) * 8 + 276 );
+    p += (8 - timers) * 8 + 276;
+
+    p = put_text( p, "cart-url", 1024 );
+    if (tagLen) {
+        memcpy( p, tagText, tagLen );
+        p += tagLen;
+    }
+    return put_padding( p, tagLen );
+}
+
+
+static uint8_t*
+put_info_chunks( uint8_t* p )
+{
+    const char* title = meta_get( &meta, "disp-title" );
+    uint8_t * list = NULL;
+    int n;
+
+    if (has_keys( "info-" )) {
+        list = p;
+        p = wave_put_chunk_header( p, "LIST", 0 );
+        memcpy( p, "INFO", 4 );
+        p += 4;
+        for (n=0; n<meta.count; n++) {
+            const char* key = meta.items[n].key;
+            uint32_t len = strlen( meta.items[n].value ) + 1;
+            int i;
+
+            if (strncmp( key, "info-", 5 )!=0 || strlen(key) != 9) continue;
+            for (i=0; i<4; i++) p[i] = (key[5+i] >= 'a' && key[5+i] <= 'z') ? key[5+i] - 0x20 : key[5+i];
+            p = wave_put_uint32( p+4, len );
+            memcpy( p, meta.items[n].value, len );
+            p = put_padding( p + len, len );
+        }
+        wave_put_uint32( list+4, p - list - 8 );
+    }
+
+    if (title) {
+        uint32_t len = strlen( title ) + 1;
+        p = wave_put_chunk_header( p, "DISP", 4 + len );
+        p = wave_put_uint32( p, 1 );    // CF_TEXT
+        memcpy( p, title, len );
+        p = put_padding( p + len, 4 + len );
+    }
+
+    return p;
+}
+
+
+// Largest size the header could be, for allocating it
+static size_t
+header_alloc()
+{
+    size_t size = 1024 + BEXT_SIZE + CART_SIZE;
+    int n;
+
+    for (n=0; n<meta.count; n++)
+        size += strlen( meta.items[n].value ) + 16;
+    return size;
+}
+
+
+// Build everything up to and including the data chunk header
+static size_t
+build_header( uint8_t* header )
+{
+    uint8_t * p = header;
+    uint64_t riffSize;
+
+    p = wave_put_chunk_header( p, "RIFF", 0 );
+    memcpy( p, "WAVE", 4 );
+    p += 4;
+
+    p = put_fmt_chunk( p );
+    if (isMpeg) p = put_mpeg_chunks( p );
+    p = put_bext_chunk( p );
+    if (has_keys( "cart-" )) p = put_cart_chunk( p );
+    p = put_info_chunks( p );
+    p = wave_put_chunk_header( p, "data", dataSize );
+
+    riffSize = (p - header) - 8 + dataSize + (dataSize & 1);
+    if (riffSize > UINT32_MAX)
+        handle_error( "Output is too large for a WAVE file." );
+    wave_put_uint32( header+4, riffSize );
+
+    return p - header;
+}
+
+
+
+/* ---- Streaming the audio ---- */
+
+// Add a block of audio to the data chunk
+static void
+emit( const uint8_t* data, size_t len )
+{
+    if (isMpeg) mpeg_index_feed( &mpegIndex, data, len );
+    write_bytes( output_fd, data, len );
+    dataSize += len;
+}
+
+
+static size_t
+read_full( uint8_t* buf, size_t len )
+{
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t res = read( input_fd, buf+got, len-got );
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) handle_error( "Unable to read from input." );
+        if (res == 0) break;
+        got += res;
+    }
+    return got;
+}
+
+
+// Work out where the audio starts, skipping any ID3v2 tag, junk
+// before the first frame, and an encoder's Xing/Info frame
+static size_t
+find_audio( const uint8_t* peek, size_t len )
+{
+    mpeg_header_t first;
+    int offset = mpeg_find_header( peek, len, &first );
+
+    if (offset < 0) handle_error( "No MPEG Audio frames found in input." );
+    if (mpeg_has_vbr_header( peek+offset, len-offset, &first ))
+        offset += first.frame_size;
+
+    // Until the frames are fed in, this is what the header is built from
+    mpegIndex.first = first;
+
+    return offset < len ? offset : len;
+}
+
+
+// Write space for the header, once the type of audio is known;
+// only the values in it change when it is filled in at the end
+static void
+reserve_header()
+{
+    header = malloc( header_alloc() );
+    if (!header) handle_error( "Unable to allocate memory for header." );
+    headerSize = build_header( header );
+    write_bytes( output_fd, header, headerSize );
+}
+
+
+// Copy part of the input file to the end of the output, within the
+// kernel if it can, otherwise by writing from the mapping
+static void
+copy_out( const uint8_t* data, off_t pos, size_t len )
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    while (len) {
+        loff_t inPos = pos;
+        ssize_t res = copy_file_range( input_fd, &inPos, output_fd, NULL, len, 0 );
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        data += res;
+        pos += res;
+        len -= res;
+    }
+#endif
+    if (len) write_bytes( output_fd, data, len );
+}
+
+
+// Stream a regular file: frames are scanned in a read-only mapping and
+// the data is copied in the kernel, so it never passes through a buffer
+static void
+stream_file( const struct stat* st )
+{
+    uint8_t peek[PEEK_BUFFER_SIZE];
+    uint64_t start = 0, end = st->st_size, pos;
+    ssize_t peekLen;
+    uint8_t * map = NULL;
+    off_t mapStart;
+
+    if (isMpeg) {
+        peekLen = pread( input_fd, peek, sizeof(peek), 0 );
+        if (peekLen < 0) handle_error( "Unable to read from input." );
+        start = id3_v2_size( peek, peekLen );
+        if (start) {
+            peekLen = pread( input_fd, peek, sizeof(peek), start );
+            if (peekLen < 0) peekLen = 0;
+        }
+        start += find_audio( peek, peekLen );
+
+        if (end > start + ID3V1_SIZE &&
+            pread( input_fd, peek, ID3V1_SIZE, end - ID3V1_SIZE ) == ID3V1_SIZE &&
+            memcmp( peek, "TAG", 3 )==0)
+            end -= ID3V1_SIZE;
+    }
+
+    reserve_header();
+    if (end <= start) return;
+
+    mapStart = start & ~(off_t)(sysconf( _SC_PAGESIZE ) - 1);
+    map = mmap( NULL, end - mapStart, PROT_READ, MAP_SHARED, input_fd, mapStart );
+    if (map == MAP_FAILED) handle_error( "Unable to map input file." );
+    madvise( map, end - mapStart, MADV_SEQUENTIAL );
+
+    for (pos = start; pos < end; ) {
+        size_t len = end - pos < STREAM_BUFFER_SIZE ? end - pos : STREAM_BUFFER_SIZE;
+        const uint8_t* data = map + (pos - mapStart);
+
+        if (isMpeg) mpeg_index_feed( &mpegIndex, data, len );
+        copy_out( data, pos, len );
+
+        pos += len;
+        dataSize += len;
+    }
+
+    munmap( map, end - mapStart );
+}
+
+
+// Stream a pipe, holding back enough to spot an ID3v1 tag at the end
+static void
+stream_pipe()
+{
+    uint8_t * buf = malloc( STREAM_BUFFER_SIZE );
+    size_t fill, start = 0, tagSize;
+
+    if (!buf) handle_error( "Unable to allocate memory for stream buffer." );
+    fill = read_full( buf, PEEK_BUFFER_SIZE );
+
+    if (isMpeg) {
+        tagSize = id3_v2_size( buf, fill );
+        if (tagSize >= fill) {
+            // Throw away the rest of a large tag
+            tagSize -= fill;
+            while (tagSize) {
+                size_t got = read_full( buf, tagSize < STREAM_BUFFER_SIZE ? tagSize : STREAM_BUFFER_SIZE );
+                if (got == 0) break;
+                tagSize -= got;
+            }
+            fill = read_full( buf, PEEK_BUFFER_SIZE );
+        } else {
+            start = tagSize;
+        }
+        start += find_audio( buf + start, fill - start );
+    }
+
+    memmove( buf, buf + start, fill - start );
+    fill -= start;
+    reserve_header();
+
+    for (;;) {
+        size_t got;
+
+        if (fill > ID3V1_SIZE) {
+            emit( buf, fill - ID3V1_SIZE );
+            memmove( buf, buf + fill - ID3V1_SIZE, ID3V1_SIZE );
+            fill = ID3V1_SIZE;
+        }
+
+        got = read_full( buf + fill, STREAM_BUFFER_SIZE - fill );
+        if (got == 0) break;
+        fill += got;
+    }
+
+    if (isMpeg && fill == ID3V1_SIZE && memcmp( buf, "TAG", 3 )==0)
+        fill = 0;
+    emit( buf, fill );
+
+    free( buf );
+}
+
+
+
+// Parse raw PCM parameters given as <rate>:<channels>:<bits>
+static int
+parse_pcm( const char* str )
+{
+    unsigned int rate, channels, bits;
+
+    if (sscanf( str, "%u:%u:%u", &rate, &channels, &bits ) != 3) return 0;
+    if (rate == 0 || channels == 0 || channels > 64 || bits == 0 || bits > 32 || bits % 8) return 0;
+
+    memset( &pcmFormat, 0, sizeof(pcmFormat) );
+    pcmFormat.audioFormat = WAVE_FORMAT_PCM;
+    pcmFormat.channels = channels;
+    pcmFormat.sampleRate = rate;
+    pcmFormat.sampleSize = bits;
+    pcmFormat.blockAlign = channels * bits / 8;
+    pcmFormat.byteRate = pcmFormat.blockAlign * rate;
+    return 1;
+}
+
+
+/* Display how to use this program */
+static int usage( const char * progname )
+{
+    fprintf(stderr, "Wave Meta Tools version %s\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <input> <output.wav>\n\n", progname);
+    fprintf(stderr, "   -m, --meta <file>         Metadata, in the format written by wavemetainfo\n");
+    fprintf(stderr, "   -p, --pcm <rate:ch:bits>  Input is raw PCM, rather than MPEG Audio\n");
+    fprintf(stderr, "The input may be '-' to read from standard input.\n\n");
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char * inputname = NULL;
+    char * outputname = NULL;
+    char * metaname = NULL;
+    struct stat fileInfo;
+    int opt;
+    static const struct option longopts[] = {
+        { "meta",           required_argument, NULL, 'm' },
+        { "pcm",            required_argument, NULL, 'p' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while ((opt = getopt_long(argc, argv, "m:p:h", longopts, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                metaname = optarg;
+                break;
+            case 'p':
+                if (!parse_pcm( optarg )) usage( argv[0] );
+                isMpeg = 0;
+                break;
+            default:
+                fprintf(stderr, "Unknown option '%c'.\n", (char)opt);
+                /* fall through */
+            case 'h':
+                usage( argv[0] );
+                break;
+        }
+    }
+
+    if (argc-optind!=2) usage( argv[0] );
+    inputname = argv[optind];
+    outputname = argv[optind+1];
+
+    // Read the metadata
+    meta_init( &meta );
+    if (metaname) {
+        FILE* file = fopen( metaname, "r" );
+        if (file == NULL) handle_error("unable to open metadata file");
+        meta_load_text( file, &meta );
+        fclose( file );
+    }
+
+    // Open the input and output
+    if (strcmp(inputname, "-")==0) {
+        input_fd = STDIN_FILENO;
+    } else {
+        input_fd = open( inputname, O_RDONLY );
+        if (input_fd<0) handle_error("unable to open input file");
+    }
+    if (fstat(input_fd, &fileInfo)) handle_error("unable to stat input");
+
+    output_fd = open( outputname, O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if (output_fd<0) handle_error("unable to open output file");
+    if (lseek( output_fd, 0, SEEK_CUR ) < 0) {
+        fprintf(stderr, "Error: the output must be a file, so that the header can be filled in.\n");
+        exit(1);
+    }
+
+    mpeg_index_init( &mpegIndex );
+    if (S_ISREG(fileInfo.st_mode)) stream_file( &fileInfo );
+    else stream_pipe();
+
+    if (isMpeg && mpegIndex.frames == 0)
+        handle_error("No MPEG Audio frames found in input.");
+    if (dataSize & 1) write_bytes( output_fd, "", 1 );
+
+    // Fill in the header, now that the audio has been seen
+    if (build_header( header ) != headerSize)
+        handle_error("header changed size");
+    if (pwrite( output_fd, header, headerSize, 0 ) != headerSize)
+        handle_error("unable to write header to output file");
+
+    if (close(output_fd)) handle_error("unable to close output file");
+    if (input_fd != STDIN_FILENO) close(input_fd);
+
+    free( header );
+    mpeg_index_free( &mpegIndex );
+    meta_free( &meta );
+
+    // Success !
+    return 0;
+}